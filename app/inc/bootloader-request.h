@@ -0,0 +1,15 @@
+#ifndef BOOTLOADER_REQUEST_H
+#define BOOTLOADER_REQUEST_H
+
+#include <stdint.h>
+#include "boot-mailbox.h"
+
+// Hands the board back to the bootloader for an update. The request goes in
+// the mailbox both linker scripts reserve, then the core resets. The
+// bootloader talks at baud (0 for its default) right away, so the host must
+// skip the sync, see flasher.py --from-app. A non-zero image_len makes the
+// bootloader refuse an image of any other length.
+void bootloader_request_update(uint32_t baud, uint32_t image_len)
+    __attribute__((noreturn));
+
+#endif  // BOOTLOADER_REQUEST_H
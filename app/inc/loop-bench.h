@@ -0,0 +1,19 @@
+#ifndef LOOP_BENCH_H
+#define LOOP_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The same loop run from the eNVM and from the eSRAM, timed with the DWT
+// cycle counter. tools/bench-exec.py reads the report off the UART.
+typedef struct {
+    uint32_t startup_cycles;  // Reset_Handler to main(), set by the caller
+    uint32_t envm_cycles;
+    uint32_t esram_cycles;  // 0 if the bootloader did not load .ram_code
+    bool match;             // Both copies computed the same result
+} LoopBenchResult;
+
+void loop_bench_run(LoopBenchResult *result);
+void loop_bench_report(const LoopBenchResult *result);
+
+#endif  // LOOP_BENCH_H
@@ -0,0 +1,14 @@
+#ifndef RAM_CODE_H
+#define RAM_CODE_H
+
+#include <stdbool.h>
+
+// Puts a function in the .ram_code section, which runs from the eSRAM
+// without the eNVM fetch wait states. The bootloader copies the section in
+// before it starts the app, see app/linkerscript.ld. The eSRAM is far out of
+// BL range from the eNVM, hence long_call.
+#define RAM_CODE __attribute__((section(".ram_code"), long_call, noinline))
+
+bool ram_code_loaded(void);
+
+#endif  // RAM_CODE_H
@@ -0,0 +1,12 @@
+#include "bootloader-request.h"
+#include "CMSIS/m2sxxx.h"
+
+volatile BootMailbox boot_mailbox __attribute__((section(".boot_mailbox")));
+
+void bootloader_request_update(uint32_t baud, uint32_t image_len) {
+    __disable_irq();
+    boot_mailbox_set(&boot_mailbox, baud, BOOT_MAILBOX_TRANSPORT_UART,
+                     image_len);
+    // The eSRAM keeps its contents over a system reset
+    NVIC_SystemReset();
+}
@@ -0,0 +1,104 @@
+#include "loop-bench.h"
+#include "ram-code.h"
+#include "CMSIS/m2sxxx.h"
+#include "CMSIS/system_m2sxxx.h"
+#include "drivers/mss_uart/mss_uart.h"
+
+#define LOOP_BENCH_BYTES  256
+#define LOOP_BENCH_ROUNDS 64
+
+static uint8_t buffer[LOOP_BENCH_BYTES];
+
+// Bitwise CRC-32, a tight loop with a branch per bit. Inlined into both
+// copies so they only differ in where they run from.
+static inline __attribute__((always_inline)) uint32_t
+loop_bench_body(const uint8_t *data, uint32_t len, uint32_t rounds) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (uint32_t i = 0; i < len; i++) {
+            crc ^= data[i];
+            for (uint32_t bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+        }
+    }
+    return ~crc;
+}
+
+static __attribute__((noinline)) uint32_t loop_envm(const uint8_t *data,
+                                                    uint32_t len,
+                                                    uint32_t rounds) {
+    return loop_bench_body(data, len, rounds);
+}
+
+RAM_CODE static uint32_t loop_esram(const uint8_t *data, uint32_t len,
+                                    uint32_t rounds) {
+    return loop_bench_body(data, len, rounds);
+}
+
+static char *put_str(char *out, const char *s);
+static char *put_u32(char *out, uint32_t value);
+
+void loop_bench_run(LoopBenchResult *result) {
+    for (uint32_t i = 0; i < LOOP_BENCH_BYTES; i++) {
+        buffer[i] = (uint8_t)(i * 7u + 1u);
+    }
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    // No SysTick in the middle of a measurement
+    __disable_irq();
+    uint32_t start = DWT->CYCCNT;
+    uint32_t envm_crc = loop_envm(buffer, LOOP_BENCH_BYTES, LOOP_BENCH_ROUNDS);
+    result->envm_cycles = DWT->CYCCNT - start;
+    result->esram_cycles = 0;
+    result->match = false;
+    if (ram_code_loaded()) {
+        start = DWT->CYCCNT;
+        uint32_t esram_crc = loop_esram(buffer, LOOP_BENCH_BYTES, LOOP_BENCH_ROUNDS);
+        result->esram_cycles = DWT->CYCCNT - start;
+        result->match = esram_crc == envm_crc;
+    }
+    __enable_irq();
+}
+
+// One JSON line, e.g. {"bench":"loop","bytes":256,"rounds":64,
+// "core_hz":100000000,"startup_cycles":...,"envm_cycles":...,
+// "esram_cycles":...,"match":true}
+void loop_bench_report(const LoopBenchResult *result) {
+    char line[192];
+    char *out = put_str(line, "{\"bench\":\"loop\",\"bytes\":");
+    out = put_u32(out, LOOP_BENCH_BYTES);
+    out = put_str(out, ",\"rounds\":");
+    out = put_u32(out, LOOP_BENCH_ROUNDS);
+    out = put_str(out, ",\"core_hz\":");
+    out = put_u32(out, SystemCoreClock);
+    out = put_str(out, ",\"startup_cycles\":");
+    out = put_u32(out, result->startup_cycles);
+    out = put_str(out, ",\"envm_cycles\":");
+    out = put_u32(out, result->envm_cycles);
+    out = put_str(out, ",\"esram_cycles\":");
+    out = put_u32(out, result->esram_cycles);
+    out = put_str(out, result->match ? ",\"match\":true}\r\n" : ",\"match\":false}\r\n");
+    *out = '\0';
+    MSS_UART_polled_tx_string(&g_mss_uart0, (const uint8_t *)line);
+}
+
+static char *put_str(char *out, const char *s) {
+    while (*s != '\0') {
+        *out++ = *s++;
+    }
+    return out;
+}
+
+static char *put_u32(char *out, uint32_t value) {
+    char digits[10];
+    uint32_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10u);
+        value /= 10u;
+    } while (value != 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
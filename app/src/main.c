@@ -1,25 +1,39 @@
 // #include <stdio.h>
 #include <stdint.h>
+#include "CMSIS/m2sxxx.h"
 #include "CMSIS/system_m2sxxx.h"
 #include "drivers/mss_gpio/mss_gpio.h"
-// #include "drivers/mss_uart/mss_uart.h"
+#include "drivers/mss_uart/mss_uart.h"
+#include "bootloader-request.h"
+#include "loop-bench.h"
+
+#define UART_BAUD 921600  // The bootloader's default, it keeps it for the update
 
 static volatile uint64_t tick = 0;
 static void delay_ms(uint32_t ms);
+static void poll_update_request(void);
 
 __attribute__((__interrupt__)) void SysTick_Handler(void) {
     tick++;
 }
 
 int main() {
+    // The startup code starts the cycle counter at reset
+    uint32_t startup_cycles = DWT->CYCCNT;
     MSS_GPIO_init();
     MSS_GPIO_config(MSS_GPIO_0, MSS_GPIO_OUTPUT_MODE);
     MSS_GPIO_config(MSS_GPIO_1, MSS_GPIO_OUTPUT_MODE);
     MSS_GPIO_config(MSS_GPIO_2, MSS_GPIO_OUTPUT_MODE);
     MSS_GPIO_config(MSS_GPIO_3, MSS_GPIO_OUTPUT_MODE);
-    // MSS_UART_init(&g_mss_uart0, MSS_UART_115200_BAUD,
-    //               MSS_UART_DATA_8_BITS | MSS_UART_NO_PARITY);
     SystemCoreClockUpdate();
+    // flasher.py --from-app sends the bootloader sync to ask for an update
+    MSS_UART_init(&g_mss_uart0, UART_BAUD,
+                  MSS_UART_DATA_8_BITS | MSS_UART_NO_PARITY | MSS_UART_ONE_STOP_BIT);
+    // eNVM against eSRAM loop timing, one JSON line for tools/bench-exec.py
+    LoopBenchResult bench;
+    loop_bench_run(&bench);
+    bench.startup_cycles = startup_cycles;
+    loop_bench_report(&bench);
     SysTick_Config(SystemCoreClock / 1000);  // 1ms
     MSS_GPIO_set_outputs(0xAA);
     /*
@@ -41,5 +55,19 @@ int main() {
 
 static void delay_ms(uint32_t ms) {
     uint64_t end = tick + ms;
-    while (tick < end);
+    while (tick < end) {
+        poll_update_request();
+    }
+}
+
+static void poll_update_request(void) {
+    static const uint8_t sync[] = {0xDE, 0xAD, 0xBE, 0xEF};
+    static uint32_t matched = 0;
+    uint8_t byte;
+    while (MSS_UART_get_rx(&g_mss_uart0, &byte, 1) == 1) {
+        matched = (byte == sync[matched]) ? matched + 1 : (byte == sync[0]);
+        if (matched == sizeof(sync)) {
+            bootloader_request_update(UART_BAUD, 0);
+        }
+    }
 }
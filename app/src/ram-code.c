@@ -0,0 +1,15 @@
+#include <string.h>
+#include <stdint.h>
+#include "ram-code.h"
+
+// From app/linkerscript.ld
+extern uint8_t __ram_code_load[];
+extern uint8_t __ram_code_start[];
+extern uint8_t __ram_code_end[];
+
+// An app started some other way, e.g. from a debugger or an older
+// bootloader, finds whatever was in the eSRAM
+bool ram_code_loaded(void) {
+    uint32_t len = (uint32_t)(__ram_code_end - __ram_code_start);
+    return memcmp(__ram_code_start, __ram_code_load, len) == 0;
+}
@@ -0,0 +1,12 @@
+# Boot policy shared by the firmware and the sim build, see inc/boot-request.h.
+# A valid app starts as soon as its digest checks out, unless the strap is
+# held or the host talks within the listen window.
+set(BL_HOST_LISTEN_MS 10 CACHE STRING "Time after reset in which bytes or a break on the UART keep the bootloader in")
+set(BL_SYNC_TIMEOUT_MS 2000 CACHE STRING "Time the bootloader then waits for the host's sync")
+set(BL_BOOT_STRAP_GPIO -1 CACHE STRING "MSS GPIO that keeps the bootloader in when low at reset, -1 for none")
+
+add_definitions(
+    -DHOST_LISTEN_MS=${BL_HOST_LISTEN_MS}
+    -DSYNC_TIMEOUT_MS=${BL_SYNC_TIMEOUT_MS}
+    -DBOOT_STRAP_GPIO=${BL_BOOT_STRAP_GPIO}
+)
@@ -0,0 +1,23 @@
+# Buffer sizes shared by the firmware and the sim build. All of them must be
+# powers of two, the sources check them with static asserts. Override on the
+# command line, e.g. cmake -DBL_UART_RX_BUFFER=4096.
+set(BL_UART_RX_BUFFER 1024 CACHE STRING "UART RX ring buffer in bytes")
+set(BL_UART_TX_BUFFER 1024 CACHE STRING "UART TX ring buffer in bytes")
+set(BL_PACKET_BUFFERS 8 CACHE STRING "Received packet slots, the largest window is one less")
+set(BL_FLASH_WRITER_PAGES 16 CACHE STRING "Flash page staging buffers")
+set(BL_TRACE_RECORDS 128 CACHE STRING "Events kept for CMD_READ_TRACE")
+# Only real on the board once the receive path and the page poll run from
+# eSRAM, the eNVM stalls the CPU while it programs. See FLASH_OVERLAP in
+# inc/flash-writer.h.
+option(BL_FLASH_OVERLAP "Let the host keep sending while eNVM pages program" OFF)
+
+add_definitions(
+    -DUART_RX_BUFFER_SIZE=${BL_UART_RX_BUFFER}
+    -DUART_TX_BUFFER_SIZE=${BL_UART_TX_BUFFER}
+    -DPACKET_BUFFER_SIZE=${BL_PACKET_BUFFERS}
+    -DFLASH_WRITER_PAGES=${BL_FLASH_WRITER_PAGES}
+    -DTRACE_RECORDS=${BL_TRACE_RECORDS}
+)
+if(BL_FLASH_OVERLAP)
+    add_definitions(-DFLASH_OVERLAP=1)
+endif()
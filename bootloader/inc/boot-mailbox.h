@@ -0,0 +1,44 @@
+#ifndef BOOT_MAILBOX_H
+#define BOOT_MAILBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Update request the app leaves for the bootloader across a soft reset. It
+// lives in the .boot_mailbox section at the bottom of the eSRAM, which both
+// linker scripts reserve and the startup code never clears. Shared with the
+// app, see app/inc/bootloader-request.h.
+#define BOOT_MAILBOX_MAGIC          0x55504454U  // "UPDT"
+#define BOOT_MAILBOX_TRANSPORT_UART 0  // MMUART0, the only one so far
+
+typedef struct {
+    uint32_t magic;
+    uint32_t baud;       // Rate the host talks at, 0 for UART_DEFAULT_BAUD
+    uint32_t transport;  // BOOT_MAILBOX_TRANSPORT_*
+    uint32_t image_len;  // Length the host will send, 0 for any
+    uint32_t check;      // boot_mailbox_check() of the words above
+} BootMailbox;
+
+// Defined once in each image, in the .boot_mailbox section
+extern volatile BootMailbox boot_mailbox;
+
+// Random RAM after a power cycle must not pass for a request
+static inline uint32_t boot_mailbox_check(const volatile BootMailbox *mb) {
+    return ~(mb->magic ^ mb->baud ^ mb->transport ^ mb->image_len);
+}
+
+static inline void boot_mailbox_set(volatile BootMailbox *mb, uint32_t baud,
+                                    uint32_t transport, uint32_t image_len) {
+    mb->baud = baud;
+    mb->transport = transport;
+    mb->image_len = image_len;
+    mb->magic = BOOT_MAILBOX_MAGIC;
+    mb->check = boot_mailbox_check(mb);
+}
+
+static inline bool boot_mailbox_valid(const volatile BootMailbox *mb) {
+    return mb->magic == BOOT_MAILBOX_MAGIC &&
+           mb->check == boot_mailbox_check(mb);
+}
+
+#endif  // BOOT_MAILBOX_H
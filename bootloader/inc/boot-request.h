@@ -0,0 +1,26 @@
+#ifndef BOOT_REQUEST_H
+#define BOOT_REQUEST_H
+
+#include "boot-mailbox.h"
+
+// Decides at reset whether to start the app right away or stay for an
+// update. Set by the build, see bootloader/boot.cmake
+#ifndef HOST_LISTEN_MS
+#define HOST_LISTEN_MS 10  // Bytes or a break within this long keep us in
+#endif
+#ifndef BOOT_STRAP_GPIO
+#define BOOT_STRAP_GPIO -1  // MSS GPIO held low to stay, -1 for none
+#endif
+
+typedef enum {
+    BOOT_REQUEST_NONE = 0,  // Valid app and nobody asking, start it
+    BOOT_REQUEST_NO_APP,    // No slot that passes image_verify()
+    BOOT_REQUEST_STRAP,     // BOOT_STRAP_GPIO held low
+    BOOT_REQUEST_HOST,      // Line activity within HOST_LISTEN_MS
+    BOOT_REQUEST_APP,       // The app left a request in the mailbox
+} BootRequest;
+
+BootRequest boot_request_check(void);
+const BootMailbox *boot_request_mailbox(void);
+
+#endif  // BOOT_REQUEST_H
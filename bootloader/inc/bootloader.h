@@ -7,17 +7,61 @@
 #include <string.h>
 
 #define NVM_BASE_ADDRESS   0x00000000u
+#define NVM_ABS_ADDRESS    0x60000000u  // eNVM outside the mirror, as seen by the system controller
 #define NVM_SIZE           0x40000U
+// CPU view of an eNVM address, the host simulation maps it onto a buffer
+#ifndef NVM_PTR
+#define NVM_PTR(addr)      ((const uint8_t *)(uintptr_t)(addr))
+#endif
+#define ESRAM_BASE_ADDRESS 0x20000000u
+#define ESRAM_SIZE         0x10000U
+// eSRAM the bootloader never uses, after the boot mailbox. An app can have
+// code copied there before it starts, see IMAGE_FLAG_RAM_CODE. Must match
+// both linker scripts.
+#define APP_RAM_CODE_ADDR  (ESRAM_BASE_ADDRESS + 0x40U)
+#define APP_RAM_CODE_SIZE  (0x4000U - 0x40U)
+// CPU view of an eSRAM address, the host simulation maps it onto a buffer
+#ifndef ESRAM_PTR
+#define ESRAM_PTR(addr)    ((uint8_t *)(uintptr_t)(addr))
+#endif
 #define BOOTLOADER_SIZE    0x08000U
-#define FW_MAX_SIZE        (NVM_SIZE - BOOTLOADER_SIZE) // 256KB - 32KB
 #define APP_START_ADDR     (NVM_BASE_ADDRESS + BOOTLOADER_SIZE)
-#define MAX_DATA_LEN       256
+// The app region holds two slots, see slot.h. Each is linked for its own
+// address, the vectors after the header stay 512-byte aligned in both.
+#define APP_SLOT_COUNT     2
+#define APP_SLOT_SIZE      0x1BC00U // 111KB
+#define APP_SLOT_ADDR(slot) (APP_START_ADDR + (slot) * APP_SLOT_SIZE)
+#define BOOT_META_ADDR     APP_SLOT_ADDR(APP_SLOT_COUNT) // Last 2KB of the eNVM
+#define BOOT_META_SIZE     (NVM_SIZE - BOOT_META_ADDR)
+#define FW_MAX_SIZE        APP_SLOT_SIZE
+#define MAX_DATA_LEN       256  // Payload limit of a v1 frame (8-bit length)
+#define MAX_FRAME_DATA_LEN 1024 // Payload limit of a v2 frame (16-bit length)
+#define FW_ADDR_LEN        4
+#define FW_SEQ_LEN         1
+#define FW_FILL_LEN        3 // Page count (16-bit BE) and pattern after the address
+#define FW_FLAGS_OFFSET    (FW_ADDR_LEN + 1) // Flags byte in CMD_FW_LEN_RESP
+#define FW_FLAG_COMMIT     0x01 // Host ends the transfer with CMD_FW_COMMIT
+#define FW_FLAG_DELTA      0x02 // Only changed pages are sent, implies commit
+#define FW_FLAG_COMPRESSED 0x04 // Data is an lz.h stream, address field is the
+                                // stream offset and the length is decompressed
+#define FW_SLOT_LEN        5 // Slot index and address in CMD_FW_LEN_REQ
+#define TRACE_OP_SUMMARY   0    // CMD_READ_TRACE: per event totals
+#define TRACE_OP_RECORDS   1    // CMD_READ_TRACE: ring records from an index
+#define TRACE_OP_RESET     2    // CMD_READ_TRACE: clear the ring and totals
+
+// Frame formats on the wire, v2 is negotiated with CMD_FRAME_FORMAT.
+// v1: cmd, len, data[len], crc8 checksum
+// v2: cmd, len (16-bit BE), data[len], CRC-32 (BE) over cmd, len and data
+#define FRAME_V1           1
+#define FRAME_V2           2
 
 typedef enum {
     BL_STATE_SYNC,
     BL_STATE_WAIT_UPDATE_REQ,
+    BL_STATE_WAIT_BAUD_CONFIRM,
     BL_STATE_WAIT_FW_LEN,
     BL_STATE_WAIT_FW_DATA,
+    BL_STATE_WAIT_COMMIT,
     BL_STATE_DONE,
     BL_STATE_FAIL,
     BL_STATE_NUM_STATES,
@@ -29,11 +73,23 @@ typedef enum {
     CMD_UPDATE_REQ      = 0x03, // Request firmware update
     CMD_FW_LEN_REQ      = 0x04, // Request firmware length
     CMD_FW_LEN_RESP     = 0x05, // Response firmware length
+    CMD_FRAME_FORMAT    = 0x06, // Negotiate frame format
+    CMD_SET_BAUD        = 0x07, // Switch the UART rate, confirmed at the new rate
     CMD_RESET           = 0x14, // Reset the device
     CMD_READ_MEM        = 0x15, // Read memory
     CMD_WRITE_MEM       = 0x16, // Write memory
     CMD_WRITE_DATA_RDY  = 0x17, // Ready for data
     CMD_FW_UPDATE_DONE  = 0x18, // Firmware update done
+    CMD_WRITE_MEM_SEQ   = 0x19, // Write memory, windowed transfer
+    CMD_WINDOW_ACK      = 0x1A, // Cumulative ACK of windowed writes
+    CMD_WINDOW_NACK     = 0x1B, // Missing sequence in windowed writes
+    CMD_FW_COMMIT       = 0x1C, // Expected image digest, ends the transfer
+    CMD_READ_HASH       = 0x1D, // CRC-32 of each flash page in a range
+    CMD_FILL_MEM        = 0x1E, // Set whole pages to one byte value
+    CMD_FILL_MEM_SEQ    = 0x1F, // Set whole pages, windowed transfer
+    CMD_READ_TRACE      = 0x20, // Cycle counts of the hot paths, see trace.h
+    CMD_GET_STATS       = 0x21, // Error and throughput counters of the session
+    CMD_SELECT_SLOT     = 0x22, // Boot the other slot from now on, see slot.h
     CMD_RETX            = 0x90, // Retransmit last packet
     CMD_ACK             = 0x91, // Acknowledge
     CMD_NACK            = 0x92, // Not Acknowledge
@@ -41,9 +97,9 @@ typedef enum {
 
 typedef struct __attribute__((packed)) {
     uint8_t cmd;
-    uint8_t len;
-    uint8_t data[MAX_DATA_LEN];
-    uint8_t checksum;
+    uint16_t len;
+    uint8_t data[MAX_FRAME_DATA_LEN];
+    uint8_t checksum;  // v1 only, v2 frames carry a CRC-32 on the wire
 } Packet;
 
 typedef struct {
@@ -52,6 +108,7 @@ typedef struct {
 } StateMachine;
 
 void bl_state_machine_init();
+void bl_skip_sync(uint32_t expected_len);
 void bl_state_machine_update();
 bool bl_need_sync();
 bool bl_is_done();
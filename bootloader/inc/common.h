@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define IS_POWER_OF_TWO(x) ((x) != 0 && ((x) & ((x) - 1)) == 0)
 
 
 #endif // COMMON_H
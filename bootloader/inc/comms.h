@@ -4,13 +4,28 @@
 #include <stdbool.h>
 #include "bootloader.h"
 
+typedef struct CommsStats {
+    uint32_t checksum_errors;  // Frames with a bad checksum or CRC-32
+    uint32_t retx_sent;        // CMD_RETX sent to the host
+    uint32_t retx_received;    // CMD_RETX from the host, last packet sent again
+    uint32_t packets_dropped;  // Good frames lost because the packet buffer was full
+} CommsStats;
 
 void comms_init();
 void comms_update();
+void comms_reset_rx();
 
 bool comms_packet_available();
 void comms_write(const Packet *packet);
-void comms_read(Packet *packet);
-Packet comms_create_cmd_packet(uint8_t cmd);
+bool comms_write_done();
+const Packet *comms_peek();
+void comms_release();
+Packet *comms_create_cmd_packet(uint8_t cmd);
+Packet *comms_create_data_packet(uint8_t cmd, const uint8_t *data, uint16_t len);
+void comms_set_frame_format(uint8_t version, uint16_t max_len);
+uint16_t comms_max_data_len();
+uint8_t comms_window_open(uint8_t requested);
+void comms_window_ack(uint8_t seq);
 uint32_t big_endian_to_uint32(const uint8_t *bytes);
+void comms_get_stats(CommsStats *out);
 #endif // COMMS_H
@@ -0,0 +1,16 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+
+// CRC-8, polynomial 0x07, initial value 0, no reflection.
+// crc8("123456789") == 0xF4, must match _crc8() in flasher.py.
+uint8_t crc8(const uint8_t *data, uint32_t len);
+
+// CRC-32 as used by zlib/Ethernet (reflected poly 0xEDB88320).
+// Start from CRC32_INIT, feed data with crc32_update() and invert the
+// result: ~crc32_update(CRC32_INIT, "123456789", 9) == 0xCBF43926.
+#define CRC32_INIT 0xFFFFFFFFu
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+
+#endif  // CRC_H
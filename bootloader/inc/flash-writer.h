@@ -0,0 +1,39 @@
+#ifndef FLASH_WRITER_H
+#define FLASH_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "drivers/mss_nvm/mss_nvm.h"
+
+#define FLASH_PAGE_SIZE     128
+// Page staging buffers, power of two, set by the build (bootloader/buffers.cmake)
+#ifndef FLASH_WRITER_PAGES
+#define FLASH_WRITER_PAGES  16
+#endif
+// Whether pages may program while the host is still sending. The eNVM
+// stalls every fetch from it while a page programs, the UART interrupt and
+// this code included, so by default the host only gets its window of one
+// ACK once the queued pages are programmed and never sends into a program.
+// Set by the build (bootloader/buffers.cmake).
+#ifndef FLASH_OVERLAP
+#define FLASH_OVERLAP 0
+#endif
+
+typedef struct FlashWriterStats {
+    uint32_t pages_programmed;
+    uint32_t errors;          // Page programs that failed to start or complete
+    uint32_t program_max_us;  // Longest page program, start to complete
+} FlashWriterStats;
+
+void flash_writer_init(void);
+void flash_writer_update(void);
+bool flash_writer_ready(uint32_t len);
+bool flash_writer_write(uint32_t addr, const uint8_t *data, uint32_t len);
+bool flash_writer_fill(uint32_t page_addr, uint8_t pattern);
+bool flash_writer_idle(void);
+nvm_status_t flash_writer_status(void);
+nvm_status_t flash_writer_drain(void);
+nvm_status_t flash_writer_flush(void);
+void flash_writer_get_stats(FlashWriterStats *out);
+
+#endif // FLASH_WRITER_H
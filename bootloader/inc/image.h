@@ -0,0 +1,50 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bootloader.h"
+
+// Each app slot starts with this header at APP_SLOT_ADDR(). It is padded to
+// IMAGE_HEADER_SIZE so the vector table after it stays aligned for VTOR (98
+// vectors need 512-byte alignment). tools/image-header.py builds it.
+#define IMAGE_HEADER_SIZE    0x200U
+#define IMAGE_MAGIC          0x49424653U  // "SFBI"
+#define IMAGE_HEADER_VERSION 2
+#define IMAGE_DIGEST_LEN     32
+#define APP_VECTORS_ADDR(slot) (APP_SLOT_ADDR(slot) + IMAGE_HEADER_SIZE)
+#define IMAGE_FLAG_RAM_CODE  0x01  // sections[] are copied to the eSRAM at boot
+#define IMAGE_MAX_SECTIONS   4
+
+// Part of the image the app runs from the eSRAM. Offset, address and length
+// are word aligned, and it has to fit in APP_RAM_CODE_ADDR/SIZE.
+typedef struct __attribute__((packed)) {
+    uint32_t offset;    // In the image, from the first byte after the header
+    uint32_t run_addr;  // Where the app was linked to run it
+    uint32_t len;
+} ImageSection;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t header_version;
+    uint32_t image_len;  // Bytes after the header
+    uint32_t flags;
+    uint8_t digest[IMAGE_DIGEST_LEN];  // SHA-256 of those bytes
+    uint32_t image_version;  // Higher is newer
+    uint32_t load_addr;      // APP_SLOT_ADDR() the image was linked for
+    // Only with IMAGE_FLAG_RAM_CODE in flags
+    uint32_t section_count;
+    ImageSection sections[IMAGE_MAX_SECTIONS];
+} ImageHeader;
+
+void image_init(void);
+void image_deinit(void);
+bool image_verify(uint8_t slot);
+uint32_t image_get_version(uint8_t slot);
+uint32_t image_verify_time_us(void);
+uint32_t image_load_ram_code(uint8_t slot);
+void image_stream_begin(uint8_t slot);
+void image_stream_update(uint32_t addr, const uint8_t *data, uint32_t len);
+bool image_commit(const uint8_t expected[IMAGE_DIGEST_LEN]);
+
+#endif  // IMAGE_H
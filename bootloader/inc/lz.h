@@ -0,0 +1,51 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Streaming decoder for the LZ4-style format written by tools/lz.py.
+// A stream is a list of sequences:
+//   token            high nibble literal count, low nibble match length - 4
+//   [255 ... n]      more literal count when the nibble is 15
+//   literals
+//   offset           16-bit LE distance back into the output, 1..window
+//   [255 ... n]      more match length when the nibble is 15
+// The last sequence stops after its literals once the output is complete.
+// Matches only reach back LZ_WINDOW_SIZE bytes, that is all the RAM needed.
+#define LZ_WINDOW_SIZE 1024  // Power of two, must match WINDOW_SIZE in lz.py
+#define LZ_MIN_MATCH   4
+
+typedef enum {
+    LZ_STATE_TOKEN,
+    LZ_STATE_LITERAL_LEN,
+    LZ_STATE_LITERALS,
+    LZ_STATE_OFFSET_LO,
+    LZ_STATE_OFFSET_HI,
+    LZ_STATE_MATCH_LEN,
+    LZ_STATE_MATCH,
+    LZ_STATE_DONE,
+    LZ_STATE_ERROR,
+} LzState;
+
+typedef struct Lz {
+    uint8_t history[LZ_WINDOW_SIZE];
+    uint32_t out_pos;  // Bytes produced so far
+    uint32_t out_len;  // Bytes the stream decodes to
+    LzState state;
+    uint8_t token;
+    uint32_t literal_len;
+    uint32_t match_len;
+    uint32_t offset;
+} Lz;
+
+void lz_init(Lz *lz, uint32_t out_len);
+// Decodes until out_cap bytes are produced or the input runs out. Returns the
+// bytes written to out and sets consumed to the input bytes used. The decoder
+// keeps its place, so the next call can continue with new input.
+uint32_t lz_decode(Lz *lz, const uint8_t *in, uint32_t in_len,
+                   uint32_t *consumed, uint8_t *out, uint32_t out_cap);
+bool lz_done(const Lz *lz);
+bool lz_failed(const Lz *lz);
+
+#endif  // LZ_H
@@ -0,0 +1,15 @@
+#ifndef MEM_OPS_H
+#define MEM_OPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The startup code's block_copy and fill_memory, see startup_m2sxxx.S. They
+// move 32 bytes per ldm/stm once source and target are word aligned, where
+// newlib-nano's memcpy() and memset() go a byte at a time. Spans that differ
+// in alignment fall back to bytes. Meant for page sized and larger spans, the
+// HPDMA is no help with them as it only moves data to or from the DDR bridge.
+void mem_copy(void *dst, const void *src, size_t len);
+void mem_fill(void *dst, uint8_t value, size_t len);
+
+#endif  // MEM_OPS_H
@@ -4,16 +4,33 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// Single producer, single consumer byte ring, e.g. an ISR writing and the
+// main loop reading. Only the producer moves write_index and only the
+// consumer moves read_index, so neither side needs to mask interrupts. The
+// size must be a power of two and one byte is kept free.
 typedef struct RingBuffer {
     uint8_t* buffer;
     uint32_t mask;
-    uint32_t read_index;
-    uint32_t write_index;
+    volatile uint32_t read_index;
+    volatile uint32_t write_index;
 } RingBuffer;
 
 void ring_buffer_init(RingBuffer* rb, uint8_t* buffer, uint32_t size);
 bool ring_buffer_empty(RingBuffer* rb);
+uint32_t ring_buffer_count(RingBuffer* rb);
+uint32_t ring_buffer_space(RingBuffer* rb);
+
+// Producer side
 bool ring_buffer_write(RingBuffer* rb, uint8_t byte);
+uint32_t ring_buffer_write_n(RingBuffer* rb, const uint8_t* data, uint32_t len);
+uint32_t ring_buffer_write_span(RingBuffer* rb, uint8_t** span);
+void ring_buffer_commit(RingBuffer* rb, uint32_t len);
+
+// Consumer side
 bool ring_buffer_read(RingBuffer* rb, uint8_t* byte);
+uint32_t ring_buffer_read_n(RingBuffer* rb, uint8_t* data, uint32_t len);
+uint32_t ring_buffer_peek(RingBuffer* rb, uint8_t* data, uint32_t len);
+uint32_t ring_buffer_read_span(RingBuffer* rb, const uint8_t** span);
+void ring_buffer_consume(RingBuffer* rb, uint32_t len);
 
 #endif  // INC_RING_BUFFER_H
@@ -0,0 +1,20 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#define SHA256_BLOCK_LEN  64
+#define SHA256_DIGEST_LEN 32
+
+typedef struct Sha256 {
+    uint32_t state[8];
+    uint64_t total_len;  // Bytes fed so far
+    uint8_t block[SHA256_BLOCK_LEN];
+    uint32_t block_len;
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const uint8_t *data, uint32_t len);
+void sha256_final(Sha256 *ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+
+#endif  // SHA256_H
@@ -0,0 +1,28 @@
+#ifndef SLOT_H
+#define SLOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bootloader.h"
+
+// Which of the APP_SLOT_COUNT app slots to start. Updates always go to the
+// slot that is not running, and only once the new image is checked does a
+// record in the metadata area at BOOT_META_ADDR make it the one to start. A
+// record is one eNVM page and each goes into the page after the last one, so
+// an interrupted write leaves the previous record in charge. Without a good
+// record the newest slot that passes image_verify() starts.
+#define SLOT_NONE        0xFF
+#define SLOT_META_MAGIC  0x534C4F54U  // "SLOT"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;  // Highest valid one is in charge
+    uint32_t slot;
+    uint32_t check;     // slot_meta_check() of the words above
+} SlotMeta;
+
+uint8_t slot_boot(void);
+uint8_t slot_update_target(void);
+bool slot_select(uint8_t slot);
+
+#endif  // SLOT_H
@@ -6,6 +6,7 @@
 void sys_time_init(void);
 void sys_time_deinit(void);
 uint64_t sys_time_get_ticks(void);
+uint64_t sys_time_get_us(void);
 void sys_time_delay_ms(uint32_t ms);
 
 #endif // SYS_TIME_H
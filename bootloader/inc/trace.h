@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hot path events stamped with the DWT cycle counter and read out with
+// CMD_READ_TRACE. The ring keeps the newest TRACE_RECORDS events, the per
+// event totals cover everything since the last reset. Build with
+// TRACE_ENABLED=0 and all of it compiles away.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 128 // Power of two, set by the build
+#endif
+
+// Same order as TRACE_EVENTS in flasher.py
+typedef enum {
+    TRACE_UART_RX_ISR,   // uart_rx_handler()
+    TRACE_COMMS_UPDATE,  // comms_update() calls that had bytes to parse
+    TRACE_FW_PACKET,     // Handling of one plain data packet
+    TRACE_NVM_PAGE,      // Page program, from start to complete
+    TRACE_SHA256,        // Streamed digest update
+    TRACE_INFLATE,       // One page of a compressed stream
+    TRACE_IMAGE_CHECK,   // Digest check at commit or boot
+    TRACE_NUM_EVENTS,
+} TraceEvent;
+
+typedef struct {
+    uint32_t start;   // Cycle count when the event started
+    uint32_t cycles;
+    uint8_t event;
+} TraceRecord;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;     // Cycles
+    uint64_t total;   // Cycles
+} TraceTotals;
+
+#if TRACE_ENABLED
+void trace_init(void);
+void trace_reset(void);
+uint32_t trace_now(void);
+void trace_record(TraceEvent event, uint32_t start);
+uint32_t trace_written(void);
+bool trace_get(uint32_t index, TraceRecord *out);
+void trace_get_totals(TraceEvent event, TraceTotals *out);
+#else
+static inline void trace_init(void) {}
+static inline void trace_reset(void) {}
+static inline uint32_t trace_now(void) { return 0; }
+static inline void trace_record(TraceEvent event, uint32_t start) {
+    (void)event;
+    (void)start;
+}
+static inline uint32_t trace_written(void) { return 0; }
+static inline bool trace_get(uint32_t index, TraceRecord *out) {
+    (void)index;
+    (void)out;
+    return false;
+}
+static inline void trace_get_totals(TraceEvent event, TraceTotals *out) {
+    (void)event;
+    *out = (TraceTotals){0};
+}
+#endif
+
+#endif // TRACE_H
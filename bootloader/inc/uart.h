@@ -4,11 +4,34 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#define UART_DEFAULT_BAUD 921600  // Rate after reset, CMD_SET_BAUD can raise it
+
+// Set by the build, see bootloader/buffers.cmake
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 1024
+#endif
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 1024
+#endif
+
+typedef struct UartStats {
+    uint32_t rx_irqs;      // RX and RX timeout interrupts taken
+    uint32_t rx_bytes;     // Bytes taken out of the RX FIFO
+    uint32_t rx_dropped;   // Bytes lost because the ring buffer was full
+    uint32_t rx_overruns;  // RX FIFO overruns reported by the UART
+    uint32_t rx_errors;    // Framing and parity errors
+} UartStats;
+
 void uart_init();
 void uart_deinit();
+bool uart_baud_supported(uint32_t baud);
+bool uart_set_baud(uint32_t baud);
+uint32_t uart_get_baud();
 void uart_write(const uint8_t *data, uint32_t len);
-uint8_t uart_read(uint8_t *data, uint32_t len);
+bool uart_tx_done();
+uint32_t uart_read(uint8_t *data, uint32_t len);
 uint8_t uart_receive_byte();
 bool uart_data_available();
+void uart_get_stats(UartStats *out);
 
 #endif  // UART_H
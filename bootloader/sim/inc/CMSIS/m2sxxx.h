@@ -0,0 +1,64 @@
+#ifndef SIM_M2SXXX_H
+#define SIM_M2SXXX_H
+
+// Just enough of the CMSIS device header for the bootloader sources
+
+typedef enum {
+    ComBlk_IRQn = 19,
+} IRQn_Type;
+
+static inline void NVIC_DisableIRQ(IRQn_Type irqn) {
+    (void)irqn;
+}
+
+static inline void NVIC_ClearPendingIRQ(IRQn_Type irqn) {
+    (void)irqn;
+}
+
+// The cycle counter follows the simulated clock, writes to it are ignored
+typedef struct {
+    uint32_t CTRL;
+    uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk       (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk   (1UL << 24)
+
+static inline DWT_Type *sim_dwt(void) {
+    static DWT_Type dwt;
+    dwt.CYCCNT = (uint32_t)(sim_time_ns() / (1000000000u / SIM_CORE_FREQ));
+    return &dwt;
+}
+
+static inline CoreDebug_Type *sim_core_debug(void) {
+    static CoreDebug_Type core_debug;
+    return &core_debug;
+}
+
+#define DWT       sim_dwt()
+#define CoreDebug sim_core_debug()
+
+// Nothing interrupts the sim, the UART is polled from the main loop
+static inline uint32_t __get_PRIMASK(void) {
+    return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t primask) {
+    (void)primask;
+}
+
+static inline void __disable_irq(void) {
+}
+
+// One core and no caches to keep in step with
+static inline void __DSB(void) {
+}
+
+static inline void __ISB(void) {
+}
+
+#endif // SIM_M2SXXX_H
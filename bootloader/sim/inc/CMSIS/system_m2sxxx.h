@@ -0,0 +1,9 @@
+#ifndef SIM_SYSTEM_M2SXXX_H
+#define SIM_SYSTEM_M2SXXX_H
+
+#include <stdint.h>
+
+// Set in sim-time.c to SIM_CORE_FREQ
+extern uint32_t SystemCoreClock;
+
+#endif // SIM_SYSTEM_M2SXXX_H
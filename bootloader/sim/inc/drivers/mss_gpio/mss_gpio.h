@@ -0,0 +1,23 @@
+#ifndef SIM_MSS_GPIO_H
+#define SIM_MSS_GPIO_H
+
+// GPIO inputs read by boot-request.c, sim-main.c sets sim_gpio_inputs
+
+#include <stdint.h>
+
+#define MSS_GPIO_INPUT_MODE 0x0000000002uL
+
+typedef uint32_t mss_gpio_id_t;
+
+extern uint32_t sim_gpio_inputs;
+
+static inline void MSS_GPIO_config(mss_gpio_id_t port_id, uint32_t config) {
+    (void)port_id;
+    (void)config;
+}
+
+static inline uint32_t MSS_GPIO_get_inputs(void) {
+    return sim_gpio_inputs;
+}
+
+#endif // SIM_MSS_GPIO_H
@@ -0,0 +1,28 @@
+#ifndef SIM_MSS_NVM_H
+#define SIM_MSS_NVM_H
+
+// Page program API of the eNVM driver, implemented by sim-nvm.c
+
+#include <stdint.h>
+
+#define NVM_DO_NOT_LOCK_PAGE    0u
+#define NVM_LOCK_PAGE           1u
+
+typedef enum nvm_status
+{
+    NVM_SUCCESS = 0,
+    NVM_PROTECTION_ERROR,
+    NVM_VERIFY_FAILURE,
+    NVM_PAGE_LOCK_ERROR,
+    NVM_PAGE_LOCK_WARNING,
+    NVM_WRITE_THRESHOLD_WARNING,
+    NVM_IN_USE_BY_OTHER_MASTER,
+    NVM_INVALID_PARAMETER
+} nvm_status_t;
+
+nvm_status_t NVM_write_page_start(uint32_t start_addr, const uint8_t *pidata,
+                                  uint32_t lock_page);
+uint32_t NVM_write_page_poll(void);
+nvm_status_t NVM_write_page_complete(void);
+
+#endif // SIM_MSS_NVM_H
@@ -0,0 +1,19 @@
+#ifndef SIM_MSS_SYS_SERVICES_H
+#define SIM_MSS_SYS_SERVICES_H
+
+// System services used by image.c, implemented by sim-sys-services.c
+
+#include <stdint.h>
+
+#define MSS_SYS_SUCCESS             0u
+#define MSS_SYS_MEM_ACCESS_ERROR    127u
+
+typedef void (*sys_serv_async_event_handler_t)(uint8_t event_opcode,
+                                               uint8_t response);
+#define MSS_SYS_NO_EVENT_HANDLER    ((sys_serv_async_event_handler_t)0)
+
+void MSS_SYS_init(sys_serv_async_event_handler_t event_handler);
+uint8_t MSS_SYS_sha256(const uint8_t *p_data_in, uint32_t length,
+                       uint8_t *result);
+
+#endif // SIM_MSS_SYS_SERVICES_H
@@ -0,0 +1,30 @@
+#ifndef SIM_H
+#define SIM_H
+
+// Host simulation of the board, force-included in every file of the sim
+// build so the bootloader sources read the eNVM through sim_nvm.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_CORE_FREQ           100000000u // M3_CLK, see sys_config_mss_clocks.h
+#define SIM_PCLK_FREQ           100000000u // APB_0, see sys_config_mss_clocks.h
+#define SIM_NVM_PROGRAM_US      1000u      // Default page program and verify time
+
+extern uint8_t sim_nvm[];
+#define NVM_PTR(addr) ((const uint8_t *)&sim_nvm[(addr)])
+extern uint8_t sim_esram[];
+#define ESRAM_PTR(addr) (&sim_esram[(addr) - 0x20000000u])
+
+uint64_t sim_time_ns(void);
+
+const char *sim_uart_open(const char *link);
+void sim_uart_update(void);
+
+bool sim_nvm_open(const char *path);
+void sim_nvm_set_program_time(uint32_t us);
+uint32_t sim_nvm_pages_programmed(void);
+bool sim_nvm_programming(void);
+uint32_t sim_uart_rx_while_programming(void);
+
+#endif // SIM_H
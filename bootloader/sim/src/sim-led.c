@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include "led.h"
+#include "drivers/mss_gpio/mss_gpio.h"
+
+// LEDs only matter when something goes wrong, report the error one
+static uint8_t leds = 0;
+
+// Inputs idle high, see drivers/mss_gpio/mss_gpio.h
+uint32_t sim_gpio_inputs = 0xFFFFFFFFu;
+
+void led_init() {
+    leds = 0;
+}
+
+void led_set_many(uint8_t value) {
+    leds = value;
+}
+
+void led_set(uint8_t index, uint8_t value) {
+    if (index == LED_ERROR && value && !(leds & (1 << LED_ERROR))) {
+        fprintf(stderr, "sim: error LED on\n");
+    }
+    if (value) {
+        leds |= 1 << index;
+    } else {
+        leds &= ~(1 << index);
+    }
+}
+
+void led_toggle(uint8_t index) {
+    leds ^= 1 << index;
+}
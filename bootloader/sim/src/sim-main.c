@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "led.h"
+#include "uart.h"
+#include "comms.h"
+#include "bootloader.h"
+#include "flash-writer.h"
+#include "image.h"
+#include "slot.h"
+#include "sys-time.h"
+#include "trace.h"
+#include "boot-request.h"
+#include "drivers/mss_gpio/mss_gpio.h"
+#include "sim.h"
+
+// Same loop as main.c, with the jump to the app replaced by a report of how
+// long the update took, or how long the boot took when there was no update.
+// Run flasher.py against the printed port.
+static const char *const BOOT_REQUEST_NAMES[] = {
+    [BOOT_REQUEST_NONE] = "none",
+    [BOOT_REQUEST_NO_APP] = "no valid app",
+    [BOOT_REQUEST_STRAP] = "strap",
+    [BOOT_REQUEST_HOST] = "host",
+    [BOOT_REQUEST_APP] = "app",
+};
+static const uint8_t SYNC_BYTES[] = {0xDE, 0xAD, 0xBE, 0xEF};
+// Where image_load_ram_code() puts the app's eSRAM sections
+uint8_t sim_esram[ESRAM_SIZE];
+
+// Stands in for app/src/main.c: waits for the host's sync at app_baud and
+// leaves an update request for the bootloader at the same rate
+static void sim_app_run(uint32_t app_baud) {
+    uart_init();
+    uart_set_baud(app_baud);
+    uint32_t matched = 0;
+    while (matched < sizeof(SYNC_BYTES)) {
+        uint8_t byte;
+        if (uart_read(&byte, 1) == 0) {
+            continue;
+        }
+        matched = (byte == SYNC_BYTES[matched]) ? matched + 1
+                                                : (byte == SYNC_BYTES[0]);
+    }
+    boot_mailbox_set(&boot_mailbox, app_baud, BOOT_MAILBOX_TRANSPORT_UART, 0);
+    printf("sim: app asked for an update, soft reset\n");
+    fflush(stdout);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-p link] [-f flash.bin] [-t page_us] [-s] [-d ms] [-a baud]\n"
+            "  -p  symlink to create for the pty, e.g. /tmp/sfbl\n"
+            "  -f  eNVM contents, created if missing and kept up to date\n"
+            "  -t  page program time in microseconds (default %u)\n"
+            "  -s  hold the boot strap (GPIO %d) so the bootloader stays\n"
+            "  -d  wait this long after opening the pty before the reset\n"
+            "  -a  run an app at this rate that hands over on the sync, see\n"
+            "      flasher.py --from-app, instead of exiting when it starts\n",
+            name, SIM_NVM_PROGRAM_US, BOOT_STRAP_GPIO);
+}
+
+int main(int argc, char **argv) {
+    const char *link = NULL;
+    const char *flash = NULL;
+    uint32_t reset_delay_ms = 0;
+    uint32_t app_baud = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:f:t:sd:a:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            link = optarg;
+            break;
+        case 'f':
+            flash = optarg;
+            break;
+        case 't':
+            sim_nvm_set_program_time(strtoul(optarg, NULL, 0));
+            break;
+        case 's':
+            sim_gpio_inputs &= ~(1u << BOOT_STRAP_GPIO);
+            break;
+        case 'd':
+            reset_delay_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            app_baud = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (flash != NULL ? !sim_nvm_open(flash) : !sim_nvm_open("/dev/null")) {
+        fprintf(stderr, "sim: cannot open %s\n", flash);
+        return 1;
+    }
+    const char *port = sim_uart_open(link);
+    if (port == NULL) {
+        perror("sim: pty");
+        return 1;
+    }
+    printf("sim: bootloader on %s\n", port);
+    fflush(stdout);
+    // What the host writes meanwhile waits in the pty for the reset
+    usleep(reset_delay_ms * 1000u);
+
+    sys_time_init();
+    BootRequest request;
+    while (1) {
+        // A soft reset keeps the time and the eSRAM, so the mailbox too
+        uint64_t reset_us = sys_time_get_us();
+        trace_init();
+        uart_init();
+        led_init();
+        image_init();
+        request = boot_request_check();
+        if (request != BOOT_REQUEST_NONE) {
+            break;
+        }
+        uint8_t slot = slot_boot();
+        uint32_t ram_code = image_load_ram_code(slot);
+        uart_deinit();
+        printf("sim: app started %.3f ms after reset, image check %u us, slot %u, "
+               "%u bytes to eSRAM\n",
+               (sys_time_get_us() - reset_us) / 1e3, image_verify_time_us(),
+               slot, ram_code);
+        fflush(stdout);
+        if (app_baud == 0) {
+            return 0;
+        }
+        sim_app_run(app_baud);
+    }
+    printf("sim: staying in the bootloader, request: %s\n",
+           BOOT_REQUEST_NAMES[request]);
+    fflush(stdout);
+    comms_init();
+    bl_state_machine_init();
+    if (request == BOOT_REQUEST_APP) {
+        const BootMailbox *mailbox = boot_request_mailbox();
+        if (mailbox->baud != 0) {
+            uart_set_baud(mailbox->baud);
+        }
+        bl_skip_sync(mailbox->image_len);
+    }
+    uint64_t sync_us = 0;
+    while (1) {
+        sim_uart_update();
+        if (!bl_need_sync()) {
+            if (sync_us == 0) {
+                sync_us = sys_time_get_us();
+            }
+            comms_update();
+        }
+        flash_writer_update();
+        bl_state_machine_update();
+        if (bl_is_done()) {
+            uint8_t slot = slot_boot();
+            if (slot == SLOT_NONE) {
+                led_set(LED_ERROR, 1);
+                uart_set_baud(UART_DEFAULT_BAUD);
+                comms_init();
+                bl_state_machine_init();
+                sync_us = 0;
+                continue;
+            }
+            uart_deinit();
+            UartStats stats;
+            uart_get_stats(&stats);
+            double seconds = sync_us ? (sys_time_get_us() - sync_us) / 1e6 : 0;
+            uint32_t pages = sim_nvm_pages_programmed();
+            printf("sim: image ok after %.3f s, %u bytes in at %u baud, "
+                   "%u pages programmed, verify %u us, %u dropped, slot %u, "
+                   "%u in while programming\n",
+                   seconds, stats.rx_bytes, uart_get_baud(), pages,
+                   image_verify_time_us(), stats.rx_dropped, slot,
+                   sim_uart_rx_while_programming());
+            fflush(stdout);
+            // Closing the pty drops what the host has not read yet
+            sys_time_delay_ms(1000);
+            return 0;
+        }
+    }
+}
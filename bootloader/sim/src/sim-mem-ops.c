@@ -0,0 +1,11 @@
+#include <string.h>
+#include "mem-ops.h"
+
+// The firmware has these in the startup code
+void mem_copy(void *dst, const void *src, size_t len) {
+    memcpy(dst, src, len);
+}
+
+void mem_fill(void *dst, uint8_t value, size_t len) {
+    memset(dst, value, len);
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include "bootloader.h"
+#include "flash-writer.h"
+#include "sim.h"
+
+// eNVM with the page program timing of the real controller. Programmed
+// pages are written through to the backing file if there is one.
+uint8_t sim_nvm[NVM_SIZE];
+
+static FILE *backing = NULL;
+static uint8_t page_data[FLASH_PAGE_SIZE];
+static uint32_t page_addr = 0;
+static bool busy = false;
+static uint64_t done_ns = 0;
+static uint32_t program_us = SIM_NVM_PROGRAM_US;
+static uint32_t pages_programmed = 0;
+
+bool sim_nvm_open(const char *path) {
+    memset(sim_nvm, 0xFF, sizeof(sim_nvm));
+    backing = fopen(path, "r+b");
+    if (backing == NULL) {
+        backing = fopen(path, "w+b");
+        if (backing == NULL) {
+            return false;
+        }
+    }
+    // A short file is an erased eNVM from there on, write that out so the
+    // file always shows what the bootloader sees
+    if (fread(sim_nvm, 1, sizeof(sim_nvm), backing) < sizeof(sim_nvm)) {
+        fseek(backing, 0, SEEK_SET);
+        fwrite(sim_nvm, 1, sizeof(sim_nvm), backing);
+        fflush(backing);
+    }
+    return true;
+}
+
+void sim_nvm_set_program_time(uint32_t us) {
+    program_us = us;
+}
+
+uint32_t sim_nvm_pages_programmed(void) {
+    return pages_programmed;
+}
+
+nvm_status_t NVM_write_page_start(uint32_t start_addr, const uint8_t *pidata,
+                                  uint32_t lock_page) {
+    (void)lock_page;
+    if (busy || (start_addr % FLASH_PAGE_SIZE) != 0 ||
+        start_addr + FLASH_PAGE_SIZE > NVM_SIZE) {
+        return NVM_INVALID_PARAMETER;
+    }
+    memcpy(page_data, pidata, FLASH_PAGE_SIZE);
+    page_addr = start_addr;
+    done_ns = sim_time_ns() + (uint64_t)program_us * 1000u;
+    busy = true;
+    return NVM_SUCCESS;
+}
+
+// On the board the CPU is stalled for as long as this is true
+bool sim_nvm_programming(void) {
+    return busy && sim_time_ns() < done_ns;
+}
+
+uint32_t NVM_write_page_poll(void) {
+    return busy && sim_time_ns() < done_ns;
+}
+
+nvm_status_t NVM_write_page_complete(void) {
+    while (NVM_write_page_poll()) {
+    }
+    if (!busy) {
+        return NVM_INVALID_PARAMETER;
+    }
+    busy = false;
+    memcpy(&sim_nvm[page_addr], page_data, FLASH_PAGE_SIZE);
+    pages_programmed++;
+    if (backing != NULL) {
+        fseek(backing, page_addr, SEEK_SET);
+        fwrite(page_data, 1, FLASH_PAGE_SIZE, backing);
+        fflush(backing);
+    }
+    return NVM_SUCCESS;
+}
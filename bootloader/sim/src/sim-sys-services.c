@@ -0,0 +1,23 @@
+#include "bootloader.h"
+#include "sha256.h"
+#include "drivers/mss_sys_services/mss_sys_services.h"
+#include "sim.h"
+
+void MSS_SYS_init(sys_serv_async_event_handler_t event_handler) {
+    (void)event_handler;
+}
+
+// The system controller sees the eNVM at NVM_ABS_ADDRESS
+uint8_t MSS_SYS_sha256(const uint8_t *p_data_in, uint32_t length,
+                       uint8_t *result) {
+    uintptr_t addr = (uintptr_t)p_data_in;
+    uint32_t len = length / 8;
+    if (addr < NVM_ABS_ADDRESS || addr + len > NVM_ABS_ADDRESS + NVM_SIZE) {
+        return MSS_SYS_MEM_ACCESS_ERROR;
+    }
+    Sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, &sim_nvm[addr - NVM_ABS_ADDRESS], len);
+    sha256_final(&ctx, result);
+    return MSS_SYS_SUCCESS;
+}
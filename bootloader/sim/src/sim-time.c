@@ -0,0 +1,54 @@
+#include <time.h>
+#include "sys-time.h"
+#include "sim.h"
+
+// The monotonic clock stands in for SysTick, ticks are milliseconds. The
+// main loop reads it every few microseconds, so a longer gap means the host
+// did not run us. The simulated board is paused for that time instead of
+// finding a burst of UART bytes it could never have kept up with.
+#define SIM_STALL_NS 2000000u
+
+uint32_t SystemCoreClock = SIM_CORE_FREQ;
+
+static uint64_t start_ns = 0;
+static uint64_t last_ns = 0;
+static uint64_t stalled_ns = 0;
+
+static uint64_t sim_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t sim_time_ns(void) {
+    uint64_t now = sim_clock_ns() - start_ns;
+    if (now - last_ns > SIM_STALL_NS) {
+        stalled_ns += now - last_ns;
+    }
+    last_ns = now;
+    return now - stalled_ns;
+}
+
+void sys_time_init(void) {
+    start_ns = sim_clock_ns();
+    last_ns = 0;
+    stalled_ns = 0;
+}
+
+void sys_time_deinit(void) {
+}
+
+uint64_t sys_time_get_ticks(void) {
+    return sim_time_ns() / 1000000u;
+}
+
+uint64_t sys_time_get_us(void) {
+    return sim_time_ns() / 1000u;
+}
+
+void sys_time_delay_ms(uint32_t ms) {
+    uint64_t end = sim_time_ns() + (uint64_t)ms * 1000000u;
+    while (sim_time_ns() < end) {
+        sim_uart_update();
+    }
+}
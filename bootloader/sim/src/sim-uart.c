@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "uart.h"
+#include "ring-buffer.h"
+#include "sim.h"
+
+// MMUART on a pty. Bytes from the host wait on the "wire" and enter the RX
+// FIFO one character time (10 bits) apart at the current rate, the same way
+// TX bytes leave. Like uart.c the FIFO is emptied into the ring at the
+// trigger level or after the receiver timeout, so bytes arrive in bursts.
+// The ring and TX buffer sizes come from the same build options as uart.c.
+#define TX_BUFFER_MASK (UART_TX_BUFFER_SIZE - 1)
+#define WIRE_SIZE (4096)
+#define RX_TRIGGER_LEVEL (8)
+#define RX_TIMEOUT_BITS (32)
+#define BAUD_MAX_ERROR (20)
+
+static int master_fd = -1;
+static int slave_fd = -1;  // Kept open so the host can close and reopen
+static RingBuffer rb = {0U};
+static uint8_t data_buffer[UART_RX_BUFFER_SIZE] = {0U};
+static UartStats stats = {0U};
+static uint32_t baud_rate = UART_DEFAULT_BAUD;
+
+static uint8_t wire[WIRE_SIZE];  // Sent by the host, not yet received
+static uint32_t wire_head = 0;
+static uint32_t wire_fifo = 0;  // wire_tail up to here is in the RX FIFO
+static uint32_t wire_tail = 0;
+static uint64_t rx_line_ns = 0;  // When the last received byte was in
+static uint32_t rx_while_programming = 0;  // Would overrun the FIFO on the board
+
+static uint8_t tx_buffer[UART_TX_BUFFER_SIZE] = {0U};
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static uint64_t tx_line_ns = 0;  // When the last sent byte is out
+
+static uint64_t sim_uart_byte_ns(void) {
+    return 10000000000ull / baud_rate;
+}
+
+const char *sim_uart_open(const char *link) {
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+        return NULL;
+    }
+    const char *name = ptsname(master_fd);
+    slave_fd = open(name, O_RDWR | O_NOCTTY);
+    if (slave_fd < 0) {
+        return NULL;
+    }
+    struct termios tio;
+    tcgetattr(slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave_fd, TCSANOW, &tio);
+    fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            return NULL;
+        }
+        return link;
+    }
+    return name;
+}
+
+void sim_uart_update(void) {
+    uint64_t now = sim_time_ns();
+    uint64_t byte_ns = sim_uart_byte_ns();
+    // Take in what the host wrote, it is on the wire from now on
+    uint32_t used = wire_head - wire_tail;
+    uint32_t head = wire_head % WIRE_SIZE;
+    uint32_t span = WIRE_SIZE - head;
+    if (span > WIRE_SIZE - used) {
+        span = WIRE_SIZE - used;
+    }
+    if (span > 0) {
+        ssize_t n = read(master_fd, &wire[head], span);
+        if (n > 0) {
+            if (used == 0 && rx_line_ns < now) {
+                rx_line_ns = now;
+            }
+            wire_head += n;
+        }
+    }
+    while (wire_fifo != wire_head && rx_line_ns + byte_ns <= now &&
+           wire_fifo - wire_tail < RX_TRIGGER_LEVEL) {
+        if (sim_nvm_programming()) {
+            rx_while_programming++;
+        }
+        wire_fifo++;
+        rx_line_ns += byte_ns;
+    }
+    if (wire_fifo != wire_tail &&
+        (wire_fifo - wire_tail >= RX_TRIGGER_LEVEL ||
+         now >= rx_line_ns + byte_ns * RX_TIMEOUT_BITS / 10)) {
+        stats.rx_irqs++;
+        while (wire_tail != wire_fifo) {
+            stats.rx_bytes++;
+            if (!ring_buffer_write(&rb, wire[wire_tail % WIRE_SIZE])) {
+                stats.rx_dropped++;
+            }
+            wire_tail++;
+        }
+    }
+    // Send what has had time to leave
+    while (tx_tail != tx_head && tx_line_ns + byte_ns <= now) {
+        if (write(master_fd, &tx_buffer[tx_tail], 1) != 1) {
+            break;
+        }
+        tx_tail = (tx_tail + 1) & TX_BUFFER_MASK;
+        tx_line_ns += byte_ns;
+    }
+}
+
+// Bytes that came in while a page was programming. The sim keeps running
+// then, the board does not, so they only show up with FLASH_OVERLAP.
+uint32_t sim_uart_rx_while_programming(void) {
+    return rx_while_programming;
+}
+
+void uart_init() {
+    baud_rate = UART_DEFAULT_BAUD;
+    tx_head = 0;
+    tx_tail = 0;
+    ring_buffer_init(&rb, data_buffer, UART_RX_BUFFER_SIZE);
+}
+
+void uart_deinit() {
+    while (!uart_tx_done()) {
+    }
+}
+
+bool uart_baud_supported(uint32_t baud) {
+    if (baud == 0 || baud > SIM_PCLK_FREQ / 16) {
+        return false;
+    }
+    uint32_t div_64 = (4u * SIM_PCLK_FREQ + baud / 2) / baud;
+    if (div_64 < 128) {
+        div_64 &= ~63u;
+    }
+    uint32_t actual = (4u * SIM_PCLK_FREQ) / div_64;
+    uint32_t diff = (actual > baud) ? actual - baud : baud - actual;
+    return diff <= (uint64_t)baud * BAUD_MAX_ERROR / 1000;
+}
+
+bool uart_set_baud(uint32_t baud) {
+    if (!uart_baud_supported(baud)) {
+        return false;
+    }
+    while (!uart_tx_done()) {
+    }
+    baud_rate = baud;
+    ring_buffer_init(&rb, data_buffer, UART_RX_BUFFER_SIZE);
+    return true;
+}
+
+uint32_t uart_get_baud() {
+    return baud_rate;
+}
+
+void uart_write(const uint8_t *data, uint32_t len) {
+    if (tx_head == tx_tail && tx_line_ns < sim_time_ns()) {
+        // Idle line, the first byte starts now
+        tx_line_ns = sim_time_ns();
+    }
+    while (len > 0) {
+        if (((tx_tail - tx_head - 1) & TX_BUFFER_MASK) == 0) {
+            sim_uart_update();
+            continue;
+        }
+        tx_buffer[tx_head] = *data++;
+        tx_head = (tx_head + 1) & TX_BUFFER_MASK;
+        len--;
+    }
+    sim_uart_update();
+}
+
+bool uart_tx_done() {
+    sim_uart_update();
+    return tx_head == tx_tail && sim_time_ns() >= tx_line_ns;
+}
+
+uint32_t uart_read(uint8_t *data, uint32_t len) {
+    sim_uart_update();
+    return ring_buffer_read_n(&rb, data, len);
+}
+
+uint8_t uart_receive_byte() {
+    uint8_t byte = 0;
+    (void)uart_read(&byte, 1);
+    return byte;
+}
+
+bool uart_data_available() {
+    sim_uart_update();
+    return !ring_buffer_empty(&rb);
+}
+
+void uart_get_stats(UartStats *out) {
+    *out = stats;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+
+// Checks crc8() and crc32_update() against crc-vectors.txt, the file
+// tools/crc-vectors.py checks flasher.py against. CRC-32 is also fed in two
+// parts at every split point, the way frames and pages are hashed.
+//
+//     crc-vectors bootloader/sim/test/crc-vectors.txt
+
+#define MAX_DATA_LEN 512
+
+static int parse_hex(const char *hex, uint8_t *out, uint32_t max) {
+    if (strcmp(hex, "-") == 0) {
+        return 0;
+    }
+    uint32_t len = strlen(hex);
+    if (len % 2 != 0 || len / 2 > max) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < len / 2; i++) {
+        unsigned int byte;
+        if (sscanf(&hex[2 * i], "%2x", &byte) != 1) {
+            return -1;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    return (int)(len / 2);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s crc-vectors.txt\n", argv[0]);
+        return 2;
+    }
+    FILE *file = fopen(argv[1], "r");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 2;
+    }
+    char line[2 * MAX_DATA_LEN + 64];
+    char hex[2 * MAX_DATA_LEN + 2];
+    uint8_t data[MAX_DATA_LEN];
+    unsigned int cases = 0;
+    unsigned int failures = 0;
+    unsigned int line_no = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        unsigned int want8;
+        unsigned int want32;
+        int len;
+        if (sscanf(line, "%1025s %x %x", hex, &want8, &want32) != 3 ||
+            (len = parse_hex(hex, data, sizeof(data))) < 0) {
+            fprintf(stderr, "line %u: cannot parse\n", line_no);
+            return 2;
+        }
+        cases++;
+        uint8_t got8 = crc8(data, len);
+        if (got8 != want8) {
+            fprintf(stderr, "line %u: crc8 %02x, expected %02x\n", line_no, got8, want8);
+            failures++;
+        }
+        for (int split = 0; split <= len; split++) {
+            uint32_t crc = crc32_update(CRC32_INIT, data, split);
+            crc = ~crc32_update(crc, &data[split], len - split);
+            if (crc != want32) {
+                fprintf(stderr, "line %u: crc32 %08x split at %d, expected %08x\n",
+                        line_no, crc, split, want32);
+                failures++;
+                break;
+            }
+        }
+    }
+    fclose(file);
+    if (cases == 0) {
+        fprintf(stderr, "no test vectors in %s\n", argv[1]);
+        return 1;
+    }
+    printf("%u CRC vectors, %u failed\n", cases, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring-buffer.h"
+
+// Runs a producer and a consumer thread on one small ring, the way the UART
+// ISR and the main loop share it, and checks every byte arrives once and in
+// order. Each side cycles through all of its calls with random lengths so
+// both wrap and partial spans get hit. Build with -DBL_SIM_TSAN=ON to have
+// ThreadSanitizer check the index ordering too.
+//
+//     ring-buffer-stress [bytes]
+
+#define RING_SIZE 64
+#define MAX_CHUNK (2 * RING_SIZE)
+#define DEFAULT_BYTES (4u * 1024 * 1024)
+
+static uint8_t ring_storage[RING_SIZE];
+static RingBuffer ring;
+static uint32_t total_bytes;
+
+// Not periodic in the ring size, so a byte from the wrong lap shows up
+static uint8_t pattern(uint32_t position) {
+    return (uint8_t)((position * 2654435761u) >> 24);
+}
+
+static uint32_t xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void *producer(void *arg) {
+    (void)arg;
+    uint32_t seed = 0x12345678;
+    uint32_t position = 0;
+    uint8_t chunk[MAX_CHUNK];
+    while (position < total_bytes) {
+        uint32_t want = 1 + xorshift(&seed) % MAX_CHUNK;
+        if (want > total_bytes - position) {
+            want = total_bytes - position;
+        }
+        uint32_t space = ring_buffer_space(&ring);
+        if (space > RING_SIZE - 1) {
+            fprintf(stderr, "producer: space %u in a %u byte ring\n", space, RING_SIZE);
+            exit(1);
+        }
+        uint32_t written = 0;
+        switch (xorshift(&seed) % 3) {
+        case 0:
+            if (ring_buffer_write(&ring, pattern(position))) {
+                written = 1;
+            }
+            break;
+        case 1:
+            for (uint32_t i = 0; i < want; i++) {
+                chunk[i] = pattern(position + i);
+            }
+            written = ring_buffer_write_n(&ring, chunk, want);
+            // Everything that was free when asked has to fit
+            if (written < want && written < space) {
+                fprintf(stderr, "producer: wrote %u of %u with %u free\n", written, want, space);
+                exit(1);
+            }
+            break;
+        default: {
+            uint8_t *span;
+            written = ring_buffer_write_span(&ring, &span);
+            if (written > want) {
+                written = want;
+            }
+            for (uint32_t i = 0; i < written; i++) {
+                span[i] = pattern(position + i);
+            }
+            ring_buffer_commit(&ring, written);
+            break;
+        }
+        }
+        position += written;
+        if (written == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void check(const uint8_t *data, uint32_t len, uint32_t position, const char *what) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] != pattern(position + i)) {
+            fprintf(stderr, "consumer: %s byte %u is %02x, expected %02x\n",
+                    what, position + i, data[i], pattern(position + i));
+            exit(1);
+        }
+    }
+}
+
+static void *consumer(void *arg) {
+    (void)arg;
+    uint32_t seed = 0x9e3779b9;
+    uint32_t position = 0;
+    uint8_t chunk[MAX_CHUNK];
+    uint8_t again[MAX_CHUNK];
+    while (position < total_bytes) {
+        uint32_t want = 1 + xorshift(&seed) % MAX_CHUNK;
+        uint32_t count = ring_buffer_count(&ring);
+        if (count > RING_SIZE - 1 || count > total_bytes - position) {
+            fprintf(stderr, "consumer: count %u at byte %u\n", count, position);
+            exit(1);
+        }
+        uint32_t got = 0;
+        switch (xorshift(&seed) % 4) {
+        case 0:
+            if (ring_buffer_read(&ring, chunk)) {
+                got = 1;
+                check(chunk, got, position, "read");
+            }
+            break;
+        case 1:
+            got = ring_buffer_read_n(&ring, chunk, want);
+            if (got < want && got < count) {
+                fprintf(stderr, "consumer: read %u of %u with %u waiting\n", got, want, count);
+                exit(1);
+            }
+            check(chunk, got, position, "read_n");
+            break;
+        case 2: {
+            // A peek leaves the bytes for the read_n after it
+            uint32_t peeked = ring_buffer_peek(&ring, chunk, want);
+            check(chunk, peeked, position, "peek");
+            got = ring_buffer_read_n(&ring, again, peeked);
+            if (got != peeked || memcmp(chunk, again, got) != 0) {
+                fprintf(stderr, "consumer: read_n after peek at byte %u differs\n", position);
+                exit(1);
+            }
+            break;
+        }
+        default: {
+            const uint8_t *span;
+            got = ring_buffer_read_span(&ring, &span);
+            if (got > want) {
+                got = want;
+            }
+            check(span, got, position, "read_span");
+            ring_buffer_consume(&ring, got);
+            break;
+        }
+        }
+        position += got;
+        if (got == 0) {
+            sched_yield();
+        }
+    }
+    if (!ring_buffer_empty(&ring)) {
+        fprintf(stderr, "consumer: %u bytes left over\n", ring_buffer_count(&ring));
+        exit(1);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    total_bytes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : DEFAULT_BYTES;
+    ring_buffer_init(&ring, ring_storage, sizeof(ring_storage));
+
+    pthread_t threads[2];
+    if (pthread_create(&threads[0], NULL, producer, NULL) != 0 ||
+        pthread_create(&threads[1], NULL, consumer, NULL) != 0) {
+        fprintf(stderr, "cannot start threads\n");
+        return 2;
+    }
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    printf("%u bytes through a %u byte ring in order\n", total_bytes, RING_SIZE);
+    return 0;
+}
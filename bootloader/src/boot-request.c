@@ -0,0 +1,75 @@
+#include "boot-request.h"
+#include "slot.h"
+#include "led.h"
+#include "uart.h"
+#include "sys-time.h"
+#if BOOT_STRAP_GPIO >= 0
+#include "drivers/mss_gpio/mss_gpio.h"
+#endif
+
+// The LEDs own the GPIOs up to LED_SYNC
+_Static_assert(BOOT_STRAP_GPIO < 0 ||
+               (BOOT_STRAP_GPIO > LED_SYNC && BOOT_STRAP_GPIO < 32),
+               "BOOT_STRAP_GPIO must be a free MSS GPIO");
+
+volatile BootMailbox boot_mailbox __attribute__((section(".boot_mailbox")));
+static BootMailbox mailbox;  // What the app left, taken at reset
+
+static bool boot_mailbox_take(void);
+static bool boot_strap_held(void);
+
+// Needs uart_init() and led_init() first. Whatever the host sends meanwhile
+// stays in the RX ring for bl_wait_sync().
+BootRequest boot_request_check(void) {
+    if (boot_mailbox_take()) {
+        return BOOT_REQUEST_APP;
+    }
+    if (boot_strap_held()) {
+        return BOOT_REQUEST_STRAP;
+    }
+    // The digest check and the listen window overlap, bytes keep arriving
+    // in the background
+    uint64_t start = sys_time_get_us();
+    if (slot_boot() == SLOT_NONE) {
+        return BOOT_REQUEST_NO_APP;
+    }
+    // A break shows up as a zero byte, same as any other character
+    while (sys_time_get_us() - start < HOST_LISTEN_MS * 1000ull) {
+        if (uart_data_available()) {
+            return BOOT_REQUEST_HOST;
+        }
+    }
+    return uart_data_available() ? BOOT_REQUEST_HOST : BOOT_REQUEST_NONE;
+}
+
+// Valid after BOOT_REQUEST_APP
+const BootMailbox *boot_request_mailbox(void) {
+    return &mailbox;
+}
+
+// A request is only good for one reset. Clearing it also writes the words
+// once, which the eSRAM EDAC needs before they can be read cleanly.
+static bool boot_mailbox_take(void) {
+    bool valid = boot_mailbox_valid(&boot_mailbox) &&
+                 boot_mailbox.transport == BOOT_MAILBOX_TRANSPORT_UART;
+    mailbox.magic = boot_mailbox.magic;
+    mailbox.baud = boot_mailbox.baud;
+    mailbox.transport = boot_mailbox.transport;
+    mailbox.image_len = boot_mailbox.image_len;
+    mailbox.check = boot_mailbox.check;
+    boot_mailbox.magic = 0;
+    boot_mailbox.baud = 0;
+    boot_mailbox.transport = 0;
+    boot_mailbox.image_len = 0;
+    boot_mailbox.check = 0;
+    return valid;
+}
+
+static bool boot_strap_held(void) {
+#if BOOT_STRAP_GPIO >= 0
+    MSS_GPIO_config((mss_gpio_id_t)BOOT_STRAP_GPIO, MSS_GPIO_INPUT_MODE);
+    return (MSS_GPIO_get_inputs() & (1u << BOOT_STRAP_GPIO)) == 0;
+#else
+    return false;
+#endif
+}
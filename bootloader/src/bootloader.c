@@ -1,33 +1,101 @@
-#include "drivers/mss_nvm/mss_nvm.h"
 #include "bootloader.h"
 #include "comms.h"
+#include "flash-writer.h"
+#include "image.h"
+#include "slot.h"
+#include "crc.h"
+#include "lz.h"
+#include "mem-ops.h"
 #include "uart.h"
 #include "led.h"
 #include "simple-sw-timer.h"
+#include "trace.h"
+#include "CMSIS/system_m2sxxx.h"
 
 #define DEFAULT_TIMEOUT 2000 // ms
+#ifndef SYNC_TIMEOUT_MS
+#define SYNC_TIMEOUT_MS 2000 // From reset to sync, see bootloader/boot.cmake
+#endif
 #define SYNC_LEN 4
+#define BAUD_CONFIRM_TIMEOUT 500 // ms, then the old rate is restored
+#define TRACE_RECORD_LEN 9 // Event, start and cycles of one record on the wire
+#define TRACE_SUMMARY_LEN (8 + 16 * TRACE_NUM_EVENTS)
+// Least payload limit a host can negotiate, a whole page with its sequence
+// number and address as a delta transfer sends it
+#define MIN_FRAME_DATA_LEN (FW_SEQ_LEN + FW_ADDR_LEN + FLASH_PAGE_SIZE)
+
+// Fixed-size replies are not split, the longest has to fit any negotiated frame
+_Static_assert(TRACE_SUMMARY_LEN <= MIN_FRAME_DATA_LEN && MIN_FRAME_DATA_LEN <= UINT8_MAX,
+               "MIN_FRAME_DATA_LEN must hold the trace summary and fit a v1 frame");
 
 static uint8_t sync_seq[SYNC_LEN] = {0};
 static BootloaderState bl_state = BL_STATE_SYNC;
 const static uint8_t SYNC_BYTES[SYNC_LEN] = {0xDE, 0xAD, 0xBE, 0xEF};
 static uint32_t fw_len = 0;
+static uint32_t fw_expected_len = 0;  // From the app's mailbox, 0 for any
 static uint32_t fw_bytes_written = 0;
+static uint8_t fw_slot = 0;     // Slot being written, see slot_update_target()
+static bool fw_commit = false;  // Host sends CMD_FW_COMMIT after the data
+static bool fw_delta = false;   // Only changed pages are sent, see CMD_READ_HASH
+static bool fw_compressed = false;  // Data is an lz.h stream, see bl_inflate_chunk()
 static SimpleTimer timeout_timer = {0};
+static SimpleTimer baud_timer = {0};
+static uint32_t baud_previous = 0;  // Rate to go back to if not confirmed
+static const Packet *borrowed = NULL;  // Lent by comms, see bl_borrow_packet()
+
+// Compressed packet being expanded into flash, one page per update. It stays
+// borrowed from comms until it is used up.
+static Lz lz;
+static const Packet *lz_pkt = NULL;
+static uint32_t lz_pkt_pos = 0;      // Next byte of lz_pkt->data to decode
+static uint32_t lz_stream_pos = 0;   // Compressed bytes accepted so far
+static bool lz_pending = false;
+
+// Fill command being applied, one page per update
+static uint32_t fill_addr = 0;
+static uint32_t fill_pages = 0;      // Pages left, the fill is done at 0
+static uint8_t fill_pattern = 0;
+static uint8_t fill_cmd = 0;
+static uint8_t fill_seq = 0;
 
 static bool bl_check_sync(uint8_t new_byte);
+static const Packet *bl_borrow_packet(void);
 static BootloaderState bl_wait_sync(void);
 static BootloaderState bl_wait_update_req(void);
+static BootloaderState bl_wait_baud_confirm(void);
 static BootloaderState bl_wait_fw_len(void);
 static BootloaderState bl_wait_fw_data(void);
+static BootloaderState bl_wait_commit(void);
 static BootloaderState bl_done(void);
 static BootloaderState bl_fail(void);
+static bool bl_write_fw_chunk(const Packet *pkt);
+static bool bl_parse_fw_chunk(const Packet *pkt, uint32_t *addr,
+                              const uint8_t **data, uint32_t *len);
+static bool bl_start_inflate(const Packet *pkt);
+static BootloaderState bl_inflate_chunk(void);
+static bool bl_start_fill(const Packet *pkt);
+static BootloaderState bl_fill_chunk(void);
+static BootloaderState bl_fw_chunk_done(uint8_t cmd, uint8_t seq);
+static bool bl_is_seq_cmd(uint8_t cmd);
+static void bl_negotiate_frame(const Packet *pkt);
+static BootloaderState bl_set_baud(const Packet *pkt);
+static void bl_send_done(void);
+static BootloaderState bl_select_slot(const Packet *pkt);
+static uint32_t bl_put_slot(uint8_t *buf, uint32_t pos, uint8_t slot);
+static BootloaderState bl_commit(const Packet *pkt);
+static void bl_send_page_hashes(const Packet *pkt);
+static void bl_send_trace(const Packet *pkt);
+static void bl_send_stats(void);
+static uint32_t bl_put_stats(uint8_t *buf, uint32_t pos);
+static uint32_t bl_put_u32(uint8_t *buf, uint32_t pos, uint32_t value);
 
 static StateMachine state_table[] = {
     {BL_STATE_SYNC, bl_wait_sync},
     {BL_STATE_WAIT_UPDATE_REQ, bl_wait_update_req},
+    {BL_STATE_WAIT_BAUD_CONFIRM, bl_wait_baud_confirm},
     {BL_STATE_WAIT_FW_LEN, bl_wait_fw_len},
     {BL_STATE_WAIT_FW_DATA, bl_wait_fw_data},
+    {BL_STATE_WAIT_COMMIT, bl_wait_commit},
     {BL_STATE_DONE, bl_done},
     {BL_STATE_FAIL, bl_fail},
 };
@@ -35,8 +103,26 @@ static StateMachine state_table[] = {
 void bl_state_machine_init() {
     bl_state = BL_STATE_SYNC;
     fw_len = 0;
+    fw_expected_len = 0;
     fw_bytes_written = 0;
+    fw_commit = false;
+    fw_delta = false;
+    fw_compressed = false;
+    lz_pending = false;
+    fill_pages = 0;
+    borrowed = NULL;
+    flash_writer_init();
+    simple_timer_init(&timeout_timer, SYNC_TIMEOUT_MS, false);
+    simple_timer_init(&baud_timer, BAUD_CONFIRM_TIMEOUT, false);
+}
+
+// The app has handed over and the host knows, it goes straight to
+// CMD_UPDATE_REQ without a sync
+void bl_skip_sync(uint32_t expected_len) {
+    fw_expected_len = expected_len;
     simple_timer_init(&timeout_timer, DEFAULT_TIMEOUT, false);
+    led_set(LED_SYNC, 1);
+    bl_state = BL_STATE_WAIT_UPDATE_REQ;
 }
 
 void bl_state_machine_update() {
@@ -44,6 +130,18 @@ void bl_state_machine_update() {
         return;
     }
     bl_state = state_table[bl_state].handler();
+    // A compressed packet stays borrowed until it is fully expanded
+    if (borrowed != NULL && !lz_pending) {
+        comms_release();
+        borrowed = NULL;
+    }
+}
+
+// Oldest received packet, without a copy. It is released once the handler
+// returns, so it must not be kept beyond that.
+static const Packet *bl_borrow_packet(void) {
+    borrowed = comms_peek();
+    return borrowed;
 }
 
 static bool did_timeout() {
@@ -57,21 +155,45 @@ BootloaderState bl_wait_sync(void) {
         }
         return BL_STATE_SYNC;
     }
-    simple_timer_reset(&timeout_timer);
+    simple_timer_init(&timeout_timer, DEFAULT_TIMEOUT, false);
     led_set(LED_SYNC, 1);
     return BL_STATE_WAIT_UPDATE_REQ;
 }
 
 BootloaderState bl_wait_update_req(void) {
-    if(comms_packet_available()) {
-        Packet pkt;
-        comms_read(&pkt);
-        if (pkt.cmd == CMD_UPDATE_REQ) {
-            Packet req = comms_create_cmd_packet(CMD_FW_LEN_REQ);
-            comms_write(&req);
+    const Packet *pkt = bl_borrow_packet();
+    if (pkt != NULL) {
+        if (pkt->cmd == CMD_FRAME_FORMAT) {
+            bl_negotiate_frame(pkt);
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_UPDATE_REQ;
+        }
+        if (pkt->cmd == CMD_SET_BAUD) {
+            simple_timer_reset(&timeout_timer);
+            return bl_set_baud(pkt);
+        }
+        if (pkt->cmd == CMD_READ_TRACE) {
+            bl_send_trace(pkt);
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_UPDATE_REQ;
+        }
+        if (pkt->cmd == CMD_GET_STATS) {
+            bl_send_stats();
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_UPDATE_REQ;
+        }
+        if (pkt->cmd == CMD_UPDATE_REQ) {
+            // The host addresses the data to the slot it is told here
+            fw_slot = slot_update_target();
+            Packet *req = comms_create_cmd_packet(CMD_FW_LEN_REQ);
+            req->len = bl_put_slot(req->data, 0, fw_slot);
+            comms_write(req);
             simple_timer_reset(&timeout_timer);
             return BL_STATE_WAIT_FW_LEN;
         }
+        if (pkt->cmd == CMD_SELECT_SLOT) {
+            return bl_select_slot(pkt);
+        }
     }
     if (did_timeout()) {
         return BL_STATE_FAIL;
@@ -79,19 +201,60 @@ BootloaderState bl_wait_update_req(void) {
     return BL_STATE_WAIT_UPDATE_REQ;
 }
 
+// The host has to repeat CMD_SET_BAUD at the new rate. The packet is echoed
+// back so both directions are checked before the rate is kept.
+BootloaderState bl_wait_baud_confirm(void) {
+    const Packet *pkt = bl_borrow_packet();
+    if (pkt != NULL) {
+        if (pkt->cmd == CMD_SET_BAUD && pkt->len >= 4 &&
+            big_endian_to_uint32(pkt->data) == uart_get_baud()) {
+            comms_write(comms_create_data_packet(CMD_SET_BAUD, pkt->data, pkt->len));
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_UPDATE_REQ;
+        }
+    }
+    if (simple_timer_has_elapsed(&baud_timer)) {
+        uart_set_baud(baud_previous);
+        comms_reset_rx();
+        simple_timer_reset(&timeout_timer);
+        return BL_STATE_WAIT_UPDATE_REQ;
+    }
+    return BL_STATE_WAIT_BAUD_CONFIRM;
+}
+
 BootloaderState bl_wait_fw_len(void) {
-    if(comms_packet_available()) {
-        Packet pkt;
-        comms_read(&pkt);
-        if (pkt.cmd == CMD_FW_LEN_RESP) {
-            fw_len = big_endian_to_uint32(pkt.data);
-            if (fw_len > FW_MAX_SIZE) {
+    const Packet *pkt = bl_borrow_packet();
+    if (pkt != NULL) {
+        if (pkt->cmd == CMD_FW_LEN_RESP) {
+            fw_len = big_endian_to_uint32(pkt->data);
+            if (fw_len > FW_MAX_SIZE ||
+                    (fw_expected_len != 0 && fw_len != fw_expected_len)) {
                 led_set(LED_ERROR, 1);
                 return BL_STATE_FAIL;
             }
-            // Signal host that we are ready for data
-            Packet rdy = comms_create_cmd_packet(CMD_WRITE_DATA_RDY);
-            comms_write(&rdy);
+            uint8_t flags = (pkt->len > FW_FLAGS_OFFSET) ? pkt->data[FW_FLAGS_OFFSET] : 0;
+            // A delta update has no byte count to finish on, it needs the commit
+            fw_delta = (flags & FW_FLAG_DELTA) != 0;
+            fw_commit = fw_delta || (flags & FW_FLAG_COMMIT);
+            fw_compressed = (flags & FW_FLAG_COMPRESSED) != 0;
+            if (fw_compressed && fw_delta) {
+                led_set(LED_ERROR, 1);
+                return BL_STATE_FAIL;
+            }
+            lz_init(&lz, fw_len);
+            lz_stream_pos = 0;
+            lz_pending = false;
+            fill_pages = 0;
+            image_stream_begin(fw_slot);
+            // Signal host that we are ready for data. A host asking for a
+            // window gets the granted size back and uses CMD_WRITE_MEM_SEQ.
+            // Without FLASH_OVERLAP it is one packet, see bl_fw_chunk_done().
+            Packet *rdy = comms_create_cmd_packet(CMD_WRITE_DATA_RDY);
+            if (pkt->len > FW_ADDR_LEN) {
+                rdy->data[0] = comms_window_open(FLASH_OVERLAP ? pkt->data[FW_ADDR_LEN] : 1);
+                rdy->len = 1;
+            }
+            comms_write(rdy);
             simple_timer_reset(&timeout_timer);
             return BL_STATE_WAIT_FW_DATA;
         }
@@ -103,31 +266,68 @@ BootloaderState bl_wait_fw_len(void) {
 }
 
 BootloaderState bl_wait_fw_data(void) {
-    if(comms_packet_available()) {
-        Packet pkt;
-        comms_read(&pkt);
-        if (pkt.cmd == CMD_WRITE_MEM) {
-            uint32_t addr = big_endian_to_uint32(pkt.data);
-            const uint8_t *data = pkt.data + sizeof(addr);
-            uint32_t len = pkt.len - sizeof(addr);
-            if(addr < APP_START_ADDR || addr + len > APP_START_ADDR + fw_len) {
+    if (flash_writer_status() != NVM_SUCCESS) {
+        led_set(LED_ERROR, 1);
+        return BL_STATE_FAIL;
+    }
+    if (lz_pending) {
+        // Finish expanding the current packet before taking the next one
+        return bl_inflate_chunk();
+    }
+    if (fill_pages > 0) {
+        return bl_fill_chunk();
+    }
+    // Leave the packet queued until there is room to stage its pages
+    const Packet *pkt = NULL;
+    if (flash_writer_ready(comms_max_data_len())) {
+        pkt = bl_borrow_packet();
+    }
+    if (pkt != NULL) {
+        if (pkt->cmd == CMD_WRITE_MEM || pkt->cmd == CMD_WRITE_MEM_SEQ) {
+            if (fw_compressed) {
+                if (!bl_start_inflate(pkt)) {
+                    led_set(LED_ERROR, 1);
+                    return BL_STATE_FAIL;
+                }
+                return bl_inflate_chunk();
+            }
+            uint32_t start = trace_now();
+            bool written = bl_write_fw_chunk(pkt);
+            trace_record(TRACE_FW_PACKET, start);
+            if (!written) {
                 led_set(LED_ERROR, 1);
                 return BL_STATE_FAIL;
             }
-            nvm_status_t status = NVM_write(addr, data, len, NVM_DO_NOT_LOCK_PAGE);
-            if (status != NVM_SUCCESS) {
+            return bl_fw_chunk_done(pkt->cmd, pkt->data[0]);
+        }
+        if ((pkt->cmd == CMD_FILL_MEM || pkt->cmd == CMD_FILL_MEM_SEQ) &&
+            !fw_compressed) {
+            if (!bl_start_fill(pkt)) {
                 led_set(LED_ERROR, 1);
                 return BL_STATE_FAIL;
             }
-            fw_bytes_written += len;
-            led_toggle(LED_FW_WRITE);
-            if (fw_bytes_written >= fw_len) {
-                Packet done = comms_create_cmd_packet(CMD_FW_UPDATE_DONE);
-                comms_write(&done);
-                return BL_STATE_DONE;
+            return bl_fill_chunk();
+        }
+        if (pkt->cmd == CMD_READ_HASH || (fw_delta && pkt->cmd == CMD_FW_COMMIT)) {
+            // Both look at the flash, so it has to be up to date
+            if (flash_writer_flush() != NVM_SUCCESS) {
+                led_set(LED_ERROR, 1);
+                return BL_STATE_FAIL;
+            }
+            if (pkt->cmd == CMD_FW_COMMIT) {
+                return bl_commit(pkt);
             }
-            Packet rdy = comms_create_cmd_packet(CMD_WRITE_DATA_RDY);
-            comms_write(&rdy);
+            bl_send_page_hashes(pkt);
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_FW_DATA;
+        }
+        if (pkt->cmd == CMD_READ_TRACE) {
+            bl_send_trace(pkt);
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_FW_DATA;
+        }
+        if (pkt->cmd == CMD_GET_STATS) {
+            bl_send_stats();
             simple_timer_reset(&timeout_timer);
             return BL_STATE_WAIT_FW_DATA;
         }
@@ -138,16 +338,409 @@ BootloaderState bl_wait_fw_data(void) {
     return BL_STATE_WAIT_FW_DATA;
 }
 
+// Acknowledges a data packet once all of it is in the flash writer. The
+// sequence number is only looked at for windowed commands.
+static BootloaderState bl_fw_chunk_done(uint8_t cmd, uint8_t seq) {
+    led_toggle(LED_FW_WRITE);
+    // The host sends again on the ACK, no page may be programming by then
+    if (!FLASH_OVERLAP && flash_writer_drain() != NVM_SUCCESS) {
+        led_set(LED_ERROR, 1);
+        return BL_STATE_FAIL;
+    }
+    if (bl_is_seq_cmd(cmd)) {
+        comms_window_ack(seq);
+    }
+    if (!fw_delta && fw_bytes_written >= fw_len) {
+        if (flash_writer_flush() != NVM_SUCCESS) {
+            led_set(LED_ERROR, 1);
+            return BL_STATE_FAIL;
+        }
+        if (fw_commit) {
+            // The digest was kept up to date while the data came in
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_COMMIT;
+        }
+        // Check the image now so the host learns about a bad one
+        if (!image_verify(fw_slot) || !slot_select(fw_slot)) {
+            led_set(LED_ERROR, 1);
+            return BL_STATE_FAIL;
+        }
+        bl_send_done();
+        return BL_STATE_DONE;
+    }
+    if (cmd == CMD_WRITE_MEM || cmd == CMD_FILL_MEM) {
+        comms_write(comms_create_cmd_packet(CMD_WRITE_DATA_RDY));
+    }
+    simple_timer_reset(&timeout_timer);
+    return BL_STATE_WAIT_FW_DATA;
+}
+
+// In a compressed transfer the address field is the offset in the stream
+static bool bl_start_inflate(const Packet *pkt) {
+    uint32_t offset;
+    const uint8_t *data;
+    uint32_t len;
+    if (!bl_parse_fw_chunk(pkt, &offset, &data, &len) ||
+        offset != lz_stream_pos) {
+        return false;
+    }
+    lz_pkt = pkt;
+    lz_pkt_pos = data - pkt->data;
+    lz_stream_pos += len;
+    lz_pending = true;
+    return true;
+}
+
+// Expands at most one page so comms keeps being serviced. A packet of zeros
+// can turn into many pages, the ACK waits until all of them are staged.
+static BootloaderState bl_inflate_chunk(void) {
+    if (!flash_writer_ready(FLASH_PAGE_SIZE)) {
+        return BL_STATE_WAIT_FW_DATA;
+    }
+    uint32_t start = trace_now();
+    uint8_t out[FLASH_PAGE_SIZE];
+    uint32_t consumed = 0;
+    uint32_t produced = lz_decode(&lz, &lz_pkt->data[lz_pkt_pos],
+                                  lz_pkt->len - lz_pkt_pos, &consumed,
+                                  out, sizeof(out));
+    lz_pkt_pos += consumed;
+    // Bytes past the end of the stream, or a call that made no progress,
+    // would keep the packet pending for good
+    bool stuck = lz_pkt_pos < lz_pkt->len &&
+                 (lz_done(&lz) || (consumed == 0 && produced == 0));
+    if (lz_failed(&lz) || stuck) {
+        led_set(LED_ERROR, 1);
+        return BL_STATE_FAIL;
+    }
+    if (produced > 0) {
+        uint32_t addr = APP_SLOT_ADDR(fw_slot) + fw_bytes_written;
+        if (!flash_writer_write(addr, out, produced)) {
+            led_set(LED_ERROR, 1);
+            return BL_STATE_FAIL;
+        }
+        image_stream_update(addr, out, produced);
+        fw_bytes_written += produced;
+    }
+    trace_record(TRACE_INFLATE, start);
+    if (consumed > 0 || produced > 0) {
+        simple_timer_reset(&timeout_timer);
+    }
+    if (lz_pkt_pos == lz_pkt->len && produced < sizeof(out)) {
+        lz_pending = false;
+        return bl_fw_chunk_done(lz_pkt->cmd, lz_pkt->data[0]);
+    }
+    return BL_STATE_WAIT_FW_DATA;
+}
+
+// Request: address, 16-bit BE page count and pattern. Only whole pages of
+// the image can be filled, the host sends a partial last page as data.
+static bool bl_start_fill(const Packet *pkt) {
+    uint32_t addr;
+    const uint8_t *data;
+    uint32_t len;
+    if (!bl_parse_fw_chunk(pkt, &addr, &data, &len) || len < FW_FILL_LEN) {
+        return false;
+    }
+    uint32_t pages = (data[0] << 8) | data[1];
+    uint32_t base = APP_SLOT_ADDR(fw_slot);
+    // Subtractions only, addr comes from the host and must not wrap around
+    if ((addr % FLASH_PAGE_SIZE) != 0 || addr < base || addr - base > fw_len ||
+        pages > (base + fw_len - addr) / FLASH_PAGE_SIZE) {
+        return false;
+    }
+    fill_addr = addr;
+    fill_pages = pages;
+    fill_pattern = data[2];
+    fill_cmd = pkt->cmd;
+    fill_seq = pkt->data[0];
+    return true;
+}
+
+// Fills at most one page per call, like bl_inflate_chunk()
+static BootloaderState bl_fill_chunk(void) {
+    if (fill_pages > 0) {
+        if (!flash_writer_ready(FLASH_PAGE_SIZE)) {
+            return BL_STATE_WAIT_FW_DATA;
+        }
+        uint8_t page[FLASH_PAGE_SIZE];
+        mem_fill(page, fill_pattern, sizeof(page));
+        if (!flash_writer_fill(fill_addr, fill_pattern)) {
+            led_set(LED_ERROR, 1);
+            return BL_STATE_FAIL;
+        }
+        image_stream_update(fill_addr, page, sizeof(page));
+        fw_bytes_written += FLASH_PAGE_SIZE;
+        fill_addr += FLASH_PAGE_SIZE;
+        fill_pages--;
+    }
+    simple_timer_reset(&timeout_timer);
+    if (fill_pages == 0) {
+        return bl_fw_chunk_done(fill_cmd, fill_seq);
+    }
+    return BL_STATE_WAIT_FW_DATA;
+}
+
+BootloaderState bl_wait_commit(void) {
+    const Packet *pkt = bl_borrow_packet();
+    if (pkt != NULL) {
+        if (pkt->cmd == CMD_FW_COMMIT) {
+            return bl_commit(pkt);
+        }
+        if (pkt->cmd == CMD_READ_TRACE) {
+            bl_send_trace(pkt);
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_COMMIT;
+        }
+        if (pkt->cmd == CMD_GET_STATS) {
+            bl_send_stats();
+            simple_timer_reset(&timeout_timer);
+            return BL_STATE_WAIT_COMMIT;
+        }
+    }
+    if (did_timeout()) {
+        return BL_STATE_FAIL;
+    }
+    return BL_STATE_WAIT_COMMIT;
+}
+
 BootloaderState bl_done(void) {
     return BL_STATE_DONE;
 }
 
+// The NACK carries the counters so the host can tell what went wrong
 BootloaderState bl_fail(void) {
-    Packet pkt = comms_create_cmd_packet(CMD_NACK);
-    comms_write(&pkt);
+    Packet *nack = comms_create_cmd_packet(CMD_NACK);
+    nack->len = bl_put_stats(nack->data, 0);
+    comms_write(nack);
+    return BL_STATE_DONE;
+}
+
+static bool bl_parse_fw_chunk(const Packet *pkt, uint32_t *addr,
+                              const uint8_t **data, uint32_t *len) {
+    const uint8_t *payload = pkt->data;
+    uint32_t header_len = FW_ADDR_LEN;
+    if (bl_is_seq_cmd(pkt->cmd)) {
+        payload += FW_SEQ_LEN;
+        header_len += FW_SEQ_LEN;
+    }
+    if (pkt->len < header_len) {
+        return false;
+    }
+    *addr = big_endian_to_uint32(payload);
+    *data = payload + FW_ADDR_LEN;
+    *len = pkt->len - header_len;
+    return true;
+}
+
+static bool bl_is_seq_cmd(uint8_t cmd) {
+    return cmd == CMD_WRITE_MEM_SEQ || cmd == CMD_FILL_MEM_SEQ;
+}
+
+static bool bl_write_fw_chunk(const Packet *pkt) {
+    uint32_t addr;
+    const uint8_t *data;
+    uint32_t len;
+    if (!bl_parse_fw_chunk(pkt, &addr, &data, &len)) {
+        return false;
+    }
+    uint32_t base = APP_SLOT_ADDR(fw_slot);
+    // Same as bl_start_fill(), addr + len could wrap
+    if (addr < base || addr - base > fw_len || len > base + fw_len - addr) {
+        return false;
+    }
+    if (!flash_writer_write(addr, data, len)) {
+        return false;
+    }
+    image_stream_update(addr, data, len);
+    fw_bytes_written += len;
+    return true;
+}
+
+// The slot only becomes the one to start once its image checks out
+static BootloaderState bl_commit(const Packet *pkt) {
+    if (pkt->len < IMAGE_DIGEST_LEN || !image_commit(pkt->data) ||
+        !slot_select(fw_slot)) {
+        led_set(LED_ERROR, 1);
+        return BL_STATE_FAIL;
+    }
+    bl_send_done();
+    return BL_STATE_DONE;
+}
+
+// Request: slot index, SLOT_NONE for the one not running, e.g. to go back to
+// the previous image. Reply: slot index and address, then the slot starts.
+static BootloaderState bl_select_slot(const Packet *pkt) {
+    uint8_t slot = (pkt->len > 0) ? pkt->data[0] : SLOT_NONE;
+    if (slot == SLOT_NONE) {
+        slot = slot_update_target();
+    }
+    if (flash_writer_flush() != NVM_SUCCESS || !slot_select(slot)) {
+        led_set(LED_ERROR, 1);
+        return BL_STATE_FAIL;
+    }
+    Packet *resp = comms_create_cmd_packet(CMD_SELECT_SLOT);
+    resp->len = bl_put_slot(resp->data, 0, slot);
+    comms_write(resp);
     return BL_STATE_DONE;
 }
 
+// Request: page aligned address and 16-bit BE page count. Reply: CRC-32 of
+// each page, BE, as many as fit in one packet. Out of range gets no pages.
+static void bl_send_page_hashes(const Packet *pkt) {
+    Packet *resp = comms_create_cmd_packet(CMD_READ_HASH);
+    uint32_t count = 0;
+    if (pkt->len >= FW_ADDR_LEN + 2) {
+        uint32_t addr = big_endian_to_uint32(pkt->data);
+        count = (pkt->data[FW_ADDR_LEN] << 8) | pkt->data[FW_ADDR_LEN + 1];
+        if (count > comms_max_data_len() / 4) {
+            count = comms_max_data_len() / 4;
+        }
+        if ((addr % FLASH_PAGE_SIZE) != 0 || addr < APP_START_ADDR ||
+            addr > BOOT_META_ADDR ||
+            count > (BOOT_META_ADDR - addr) / FLASH_PAGE_SIZE) {
+            count = 0;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint8_t *page = NVM_PTR(addr + i * FLASH_PAGE_SIZE);
+            uint32_t crc = ~crc32_update(CRC32_INIT, page, FLASH_PAGE_SIZE);
+            bl_put_u32(resp->data, 4 * i, crc);
+        }
+    }
+    resp->len = count * 4;
+    comms_write(resp);
+}
+
+// Request: TRACE_OP_* and for TRACE_OP_RECORDS a 16-bit BE index, 0 being
+// the oldest record kept. The summary is the core clock, the number of
+// records ever written and count, max and 64-bit total cycles of each event.
+// Records are event, start and cycles, as many as fit in one packet.
+static void bl_send_trace(const Packet *pkt) {
+    Packet *resp = comms_create_cmd_packet(CMD_READ_TRACE);
+    uint8_t *reply = resp->data;
+    uint32_t len = 0;
+    uint8_t op = (pkt->len > 0) ? pkt->data[0] : TRACE_OP_SUMMARY;
+    if (op == TRACE_OP_RESET) {
+        trace_reset();
+    } else if (op == TRACE_OP_RECORDS) {
+        uint32_t index = (pkt->len >= 3) ? ((pkt->data[1] << 8) | pkt->data[2]) : 0;
+        TraceRecord record;
+        while (len + TRACE_RECORD_LEN <= comms_max_data_len() &&
+               trace_get(index++, &record)) {
+            reply[len++] = record.event;
+            len = bl_put_u32(reply, len, record.start);
+            len = bl_put_u32(reply, len, record.cycles);
+        }
+    } else {
+        len = bl_put_u32(reply, len, SystemCoreClock);
+        len = bl_put_u32(reply, len, trace_written());
+        for (uint32_t i = 0; i < TRACE_NUM_EVENTS; i++) {
+            TraceTotals totals;
+            trace_get_totals((TraceEvent)i, &totals);
+            len = bl_put_u32(reply, len, totals.count);
+            len = bl_put_u32(reply, len, totals.max);
+            len = bl_put_u32(reply, len, (uint32_t)(totals.total >> 32));
+            len = bl_put_u32(reply, len, (uint32_t)totals.total);
+        }
+    }
+    resp->len = len;
+    comms_write(resp);
+}
+
+// Slot index and its address, FW_SLOT_LEN bytes
+static uint32_t bl_put_slot(uint8_t *buf, uint32_t pos, uint8_t slot) {
+    buf[pos] = slot;
+    return bl_put_u32(buf, pos + 1, APP_SLOT_ADDR(slot));
+}
+
+// Stores value BE at pos and returns the position after it
+static uint32_t bl_put_u32(uint8_t *buf, uint32_t pos, uint32_t value) {
+    buf[pos] = value >> 24;
+    buf[pos + 1] = value >> 16;
+    buf[pos + 2] = value >> 8;
+    buf[pos + 3] = value;
+    return pos + 4;
+}
+
+// Reports how long the image check took, in microseconds, followed by the
+// session counters
+static void bl_send_done(void) {
+    Packet *done = comms_create_cmd_packet(CMD_FW_UPDATE_DONE);
+    done->len = bl_put_u32(done->data, 0, image_verify_time_us());
+    done->len = bl_put_stats(done->data, done->len);
+    comms_write(done);
+}
+
+static void bl_send_stats(void) {
+    Packet *resp = comms_create_cmd_packet(CMD_GET_STATS);
+    resp->len = bl_put_stats(resp->data, 0);
+    comms_write(resp);
+}
+
+// Stores the counters BE in the order of STATS_FIELDS in flasher.py
+static uint32_t bl_put_stats(uint8_t *buf, uint32_t pos) {
+    UartStats uart;
+    CommsStats comms;
+    FlashWriterStats flash;
+    uart_get_stats(&uart);
+    comms_get_stats(&comms);
+    flash_writer_get_stats(&flash);
+    pos = bl_put_u32(buf, pos, uart.rx_bytes);
+    pos = bl_put_u32(buf, pos, uart.rx_irqs);
+    pos = bl_put_u32(buf, pos, uart.rx_dropped);
+    pos = bl_put_u32(buf, pos, uart.rx_overruns);
+    pos = bl_put_u32(buf, pos, uart.rx_errors);
+    pos = bl_put_u32(buf, pos, comms.checksum_errors);
+    pos = bl_put_u32(buf, pos, comms.retx_sent);
+    pos = bl_put_u32(buf, pos, comms.retx_received);
+    pos = bl_put_u32(buf, pos, comms.packets_dropped);
+    pos = bl_put_u32(buf, pos, flash.pages_programmed);
+    pos = bl_put_u32(buf, pos, flash.errors);
+    pos = bl_put_u32(buf, pos, flash.program_max_us);
+    pos = bl_put_u32(buf, pos, image_verify_time_us());
+    return pos;
+}
+
+// Request: version and optional 16-bit BE max payload, no less than
+// MIN_FRAME_DATA_LEN is granted. The reply carries the granted version and
+// payload limit and still goes out in the old format. Both sides keep to
+// the limit from then on.
+static void bl_negotiate_frame(const Packet *pkt) {
+    uint8_t version = (pkt->len > 0) ? pkt->data[0] : FRAME_V1;
+    if (version != FRAME_V2) {
+        version = FRAME_V1;
+    }
+    uint16_t max_len = (version == FRAME_V2) ? MAX_FRAME_DATA_LEN : UINT8_MAX;
+    if (pkt->len >= 3) {
+        uint16_t requested = (pkt->data[1] << 8) | pkt->data[2];
+        if (requested < max_len) {
+            max_len = (requested > MIN_FRAME_DATA_LEN) ? requested : MIN_FRAME_DATA_LEN;
+        }
+    }
+    uint8_t reply[3] = {version, (uint8_t)(max_len >> 8), (uint8_t)max_len};
+    comms_write(comms_create_data_packet(CMD_FRAME_FORMAT, reply, sizeof(reply)));
+    comms_set_frame_format(version, max_len);
+}
+
+// Request: 32-bit BE rate. The reply, still at the old rate, carries the
+// rate that will be used or 0 if the UART cannot get close enough to it.
+static BootloaderState bl_set_baud(const Packet *pkt) {
+    uint32_t baud = (pkt->len >= 4) ? big_endian_to_uint32(pkt->data) : 0;
+    if (!uart_baud_supported(baud)) {
+        baud = 0;
+    }
+    uint8_t reply[4] = {baud >> 24, baud >> 16, baud >> 8, baud};
+    comms_write(comms_create_data_packet(CMD_SET_BAUD, reply, sizeof(reply)));
+    if (baud == 0) {
+        return BL_STATE_WAIT_UPDATE_REQ;
+    }
+    baud_previous = uart_get_baud();
+    // Sends out the reply at the old rate before switching
+    uart_set_baud(baud);
+    comms_reset_rx();
+    simple_timer_reset(&baud_timer);
+    return BL_STATE_WAIT_BAUD_CONFIRM;
+}
+
 bool bl_check_sync(uint8_t new_byte) {
     for (int i = 0; i < SYNC_LEN - 1; i++) {
         sync_seq[i] = sync_seq[i + 1];
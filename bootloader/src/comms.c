@@ -1,106 +1,273 @@
 #include <string.h>
 #include "comms.h"
+#include "crc.h"
 #include "uart.h"
 #include "led.h"
+#include "trace.h"
+#include "common.h"
 #include "drivers/mss_nvm/mss_nvm.h"
 
-#define PACKET_BUFFER_SIZE 4  // Number of packets in the buffer
+// Number of packets in the buffer, set by the build (bootloader/buffers.cmake)
+#ifndef PACKET_BUFFER_SIZE
+#define PACKET_BUFFER_SIZE 8
+#endif
+#define MAX_WINDOW_SIZE (PACKET_BUFFER_SIZE - 1)
+
+// One slot is always free to receive into. Sequence numbers are compared as
+// int8_t, so the window has to stay below 128.
+_Static_assert(IS_POWER_OF_TWO(PACKET_BUFFER_SIZE) && PACKET_BUFFER_SIZE >= 2 &&
+               PACKET_BUFFER_SIZE <= 128,
+               "PACKET_BUFFER_SIZE must be a power of two from 2 to 128");
+
+#define FRAME_V2_HEADER_LEN 3
+#define FRAME_V2_CRC_LEN 4
 
 typedef enum {
     STATE_RECEIVING_CMD,
     STATE_RECEIVING_LEN,
+    STATE_RECEIVING_LEN_LO,  // Second length byte of a v2 frame
     STATE_RECEIVING_DATA,
     STATE_RECEIVING_CHECKSUM
 } CommsState;
 
-static uint8_t data_byte_count = 0;
+static uint16_t data_byte_count = 0;
+static uint8_t checksum_byte_count = 0;
+static uint32_t rx_crc = 0;  // CRC-32 trailer of the v2 frame being received
 static CommsState rx_state = STATE_RECEIVING_CMD;
-static Packet last_tx_packet = {0}; // Last packet sent over comms
-static Packet temp_packet = {0};  // Temporary packet for reading from UART
-static Packet packet_ack = {0};
-static Packet packet_retx = {0};
+static uint8_t frame_version = FRAME_V1;
+static uint16_t max_data_len = UINT8_MAX;  // Payload limit agreed with the host
+static Packet tx_packet = {0};  // Filled by comms_create_*_packet()
+// Frame sent last, again on CMD_RETX. The payload is only referenced, it is
+// left alone until the next frame is created or sent.
+static uint8_t last_tx_cmd = 0;
+static const uint8_t *last_tx_data = NULL;
+static uint16_t last_tx_len = 0;
+// The ACK, RETX and window ACK/NACK comms sends itself carry at most one
+// byte, it goes here rather than in a whole Packet
+static uint8_t control_data = 0;
 
+// Frames are parsed straight into the slot at packet_write_index, which is
+// always free, and queued by moving the index on. The slot at
+// packet_read_index is lent out by comms_peek() until comms_release().
 static Packet packet_buffer[PACKET_BUFFER_SIZE];
 static uint32_t packet_read_index = 0;
 static uint32_t packet_write_index = 0;
 static uint32_t packet_buffer_mask = PACKET_BUFFER_SIZE - 1;
+static Packet *rx_packet = &packet_buffer[0];  // Frame being received
+
+static CommsStats stats = {0};
+
+static uint8_t window_expected_seq = 0;
+static uint8_t window_acked_seq = 0;  // Last seq acknowledged to the host
+static bool window_nack_sent = false;
 
 static uint8_t comms_receive_byte();
-static uint8_t calculate_checksum(const Packet *packet);
-static uint8_t crc8(const uint8_t *data, uint8_t len);
+static bool comms_enqueue(void);
+static void comms_window_receive(const Packet *packet);
+static void comms_start_data(void);
+static bool comms_receive_checksum(uint8_t byte);
+static void comms_write_frame(uint8_t cmd, const uint8_t *data, uint16_t len);
+static void comms_write_control(uint8_t cmd, uint8_t data, uint16_t len);
+static uint8_t calculate_checksum(uint8_t cmd, const uint8_t *data, uint16_t len);
+static uint32_t calculate_crc32(uint8_t cmd, const uint8_t *data, uint16_t len);
 
 void comms_init() {
-    packet_ack.cmd = CMD_ACK;
-    packet_ack.len = 1;
-    packet_ack.checksum = calculate_checksum(&packet_ack);
-    packet_retx.cmd = CMD_RETX;
-    packet_retx.len = 0;
-    packet_retx.checksum = calculate_checksum(&packet_retx);
+    memset(&stats, 0, sizeof(stats));
+    frame_version = FRAME_V1;
+    max_data_len = UINT8_MAX;
+    rx_state = STATE_RECEIVING_CMD;
+    packet_read_index = 0;
+    packet_write_index = 0;
+    rx_packet = &packet_buffer[0];
+    last_tx_data = NULL;
+    comms_window_open(1);
+}
+
+// Drops a partly received frame, e.g. after the line rate changed
+void comms_reset_rx() {
+    rx_state = STATE_RECEIVING_CMD;
+}
+
+// Both return the one TX packet, a reply can also be built in place in its
+// data before setting len. It is valid until the next packet is created.
+Packet *comms_create_cmd_packet(uint8_t cmd) {
+    tx_packet.cmd = cmd;
+    tx_packet.len = 0;
+    return &tx_packet;
+}
+
+Packet *comms_create_data_packet(uint8_t cmd, const uint8_t *data, uint16_t len) {
+    tx_packet.cmd = cmd;
+    tx_packet.len = len;
+    memcpy(tx_packet.data, data, len);
+    return &tx_packet;
+}
+
+uint8_t comms_window_open(uint8_t requested) {
+    uint8_t window = requested;
+    if (window > MAX_WINDOW_SIZE) {
+        window = MAX_WINDOW_SIZE;
+    } else if (window == 0) {
+        window = 1;
+    }
+    window_expected_seq = 0;
+    window_nack_sent = false;
+    // Nothing acknowledged yet, the host ignores an ACK for seq 0xFF
+    window_acked_seq = window_expected_seq - 1;
+    return window;
+}
+
+void comms_window_ack(uint8_t seq) {
+    window_acked_seq = seq;
+    comms_write_control(CMD_WINDOW_ACK, seq, 1);
 }
 
-Packet comms_create_cmd_packet(uint8_t cmd) {
-    Packet pkt = {0};
-    pkt.cmd = cmd;
-    pkt.len = 0;
-    pkt.checksum = calculate_checksum(&pkt);
-    return pkt;
+// Payloads both ways stay within max_len from now on, and within what the
+// frame version can carry
+void comms_set_frame_format(uint8_t version, uint16_t max_len) {
+    frame_version = (version == FRAME_V2) ? FRAME_V2 : FRAME_V1;
+    uint16_t limit = (frame_version == FRAME_V2) ? MAX_FRAME_DATA_LEN : UINT8_MAX;
+    max_data_len = (max_len < limit) ? max_len : limit;
+}
+
+uint16_t comms_max_data_len() {
+    return max_data_len;
 }
 
 void comms_update() {
+    if (!uart_data_available()) {
+        return;
+    }
+    uint32_t start = trace_now();
     while (uart_data_available()) {
         switch (rx_state) {
             case STATE_RECEIVING_CMD:
-                temp_packet.cmd = comms_receive_byte();
+                rx_packet->cmd = comms_receive_byte();
                 rx_state = STATE_RECEIVING_LEN;
                 break;
             case STATE_RECEIVING_LEN:
-                temp_packet.len = comms_receive_byte();
-                if (temp_packet.len > MAX_DATA_LEN) {
-                    rx_state = STATE_RECEIVING_CMD;
-                } else {
-                    data_byte_count = 0;
-                    rx_state = (temp_packet.len > 0) ? STATE_RECEIVING_DATA
-                                                     : STATE_RECEIVING_CHECKSUM;
+                rx_packet->len = comms_receive_byte();
+                if (frame_version == FRAME_V2) {
+                    rx_packet->len <<= 8;
+                    rx_state = STATE_RECEIVING_LEN_LO;
+                    break;
                 }
+                comms_start_data();
+                break;
+            case STATE_RECEIVING_LEN_LO:
+                rx_packet->len |= comms_receive_byte();
+                comms_start_data();
                 break;
             case STATE_RECEIVING_DATA:
-                temp_packet.data[data_byte_count++] = comms_receive_byte();
-                if (data_byte_count >= temp_packet.len) {
+                // Take whatever of the payload is already in
+                data_byte_count += uart_read(&rx_packet->data[data_byte_count],
+                                             rx_packet->len - data_byte_count);
+                if (data_byte_count >= rx_packet->len) {
                     rx_state = STATE_RECEIVING_CHECKSUM;
                 }
                 break;
             case STATE_RECEIVING_CHECKSUM:
-                temp_packet.checksum = comms_receive_byte();
-                if (calculate_checksum(&temp_packet) != temp_packet.checksum) {
+                if (!comms_receive_checksum(comms_receive_byte())) {
+                    break;
+                }
+                if ((frame_version == FRAME_V2)
+                        ? (calculate_crc32(rx_packet->cmd, rx_packet->data,
+                                           rx_packet->len) != rx_crc)
+                        : (calculate_checksum(rx_packet->cmd, rx_packet->data,
+                                              rx_packet->len) != rx_packet->checksum)) {
                     led_set(LED_ERROR, 1);
-                    comms_write(&packet_retx);
+                    stats.checksum_errors++;
+                    stats.retx_sent++;
+                    comms_write_control(CMD_RETX, 0, 0);
                     rx_state = STATE_RECEIVING_CMD;
                     break;
                 }
-                if (temp_packet.cmd == CMD_RETX) {
-                    comms_write(&last_tx_packet);
+                rx_state = STATE_RECEIVING_CMD;
+                if (rx_packet->cmd == CMD_RETX) {
+                    stats.retx_received++;
+                    if (last_tx_data != NULL) {
+                        comms_write_frame(last_tx_cmd, last_tx_data, last_tx_len);
+                    }
                     break;
-                } 
-                uint32_t next_wr_index =
-                    (packet_write_index + 1) & packet_buffer_mask;
-                if (next_wr_index != packet_read_index) {
-                    led_toggle(LED_COMMS);
-                    memcpy(&packet_buffer[packet_write_index], &temp_packet,
-                        sizeof(Packet));
-                    packet_write_index = next_wr_index;
-                    packet_ack.data[0] = temp_packet.cmd;
-                    packet_ack.checksum = calculate_checksum(&packet_ack);
-                    comms_write(&packet_ack);
-                } else {
-                    led_set(LED_ERROR, 1);
                 }
-                rx_state = STATE_RECEIVING_CMD;
+                if (rx_packet->cmd == CMD_WRITE_MEM_SEQ ||
+                    rx_packet->cmd == CMD_FILL_MEM_SEQ) {
+                    // Windowed writes are acknowledged by the bootloader
+                    // once programmed, see comms_window_ack()
+                    comms_window_receive(rx_packet);
+                    break;
+                }
+                uint8_t cmd = rx_packet->cmd;
+                if (comms_enqueue()) {
+                    comms_write_control(CMD_ACK, cmd, 1);
+                }
                 break;
             default:
                 rx_state = STATE_RECEIVING_CMD;
                 break;
         }
     }
+    trace_record(TRACE_COMMS_UPDATE, start);
+}
+
+static void comms_start_data(void) {
+    if (rx_packet->len > comms_max_data_len()) {
+        rx_state = STATE_RECEIVING_CMD;
+        return;
+    }
+    data_byte_count = 0;
+    checksum_byte_count = 0;
+    rx_crc = 0;
+    rx_state = (rx_packet->len > 0) ? STATE_RECEIVING_DATA
+                                     : STATE_RECEIVING_CHECKSUM;
+}
+
+// Returns true once the whole checksum (v1) or CRC-32 (v2) is in
+static bool comms_receive_checksum(uint8_t byte) {
+    if (frame_version == FRAME_V1) {
+        rx_packet->checksum = byte;
+        return true;
+    }
+    rx_crc = (rx_crc << 8) | byte;
+    return ++checksum_byte_count == FRAME_V2_CRC_LEN;
+}
+
+// Queues the frame just received in place. Without a free slot to receive
+// the next one into it is dropped and its slot reused.
+static bool comms_enqueue(void) {
+    uint32_t next_wr_index = (packet_write_index + 1) & packet_buffer_mask;
+    if (next_wr_index == packet_read_index) {
+        led_set(LED_ERROR, 1);
+        stats.packets_dropped++;
+        return false;
+    }
+    led_toggle(LED_COMMS);
+    packet_write_index = next_wr_index;
+    rx_packet = &packet_buffer[packet_write_index];
+    return true;
+}
+
+static void comms_window_receive(const Packet *packet) {
+    if (packet->len < FW_SEQ_LEN) {
+        return;
+    }
+    uint8_t seq = packet->data[0];
+    int8_t distance = (int8_t)(seq - window_expected_seq);
+    if (distance == 0) {
+        if (comms_enqueue()) {
+            window_expected_seq++;
+            window_nack_sent = false;
+        }
+    } else if (distance > 0) {
+        // A packet went missing, ask once for the host to resend from it
+        if (!window_nack_sent) {
+            comms_write_control(CMD_WINDOW_NACK, window_expected_seq, 1);
+            window_nack_sent = true;
+        }
+    } else if ((int8_t)(seq - window_acked_seq) <= 0) {
+        // Duplicate of an already programmed packet, our ACK was lost
+        comms_write_control(CMD_WINDOW_ACK, window_acked_seq, 1);
+    }
 }
 
 bool comms_packet_available() {
@@ -114,45 +281,77 @@ static uint8_t comms_receive_byte() {
 }
 
 void comms_write(const Packet *packet) {
-    uart_write(&packet->cmd, 1);
-    uart_write(&packet->len, 1);
-    if (packet->len > 0) {
-        uart_write(packet->data, packet->len);
+    comms_write_frame(packet->cmd, packet->data, packet->len);
+}
+
+static void comms_write_frame(uint8_t cmd, const uint8_t *data, uint16_t len) {
+    // Header, payload and trailer end up back to back in the UART TX buffer
+    // and go out in the background
+    if (frame_version == FRAME_V2) {
+        uint8_t header[FRAME_V2_HEADER_LEN] = {cmd, (uint8_t)(len >> 8), (uint8_t)len};
+        uint32_t crc = calculate_crc32(cmd, data, len);
+        uint8_t trailer[FRAME_V2_CRC_LEN] = {
+            (uint8_t)(crc >> 24), (uint8_t)(crc >> 16),
+            (uint8_t)(crc >> 8), (uint8_t)crc};
+        uart_write(header, sizeof(header));
+        uart_write(data, len);
+        uart_write(trailer, sizeof(trailer));
+    } else {
+        uint8_t header[2] = {cmd, (uint8_t)len};
+        uint8_t checksum = calculate_checksum(cmd, data, len);
+        uart_write(header, sizeof(header));
+        uart_write(data, len);
+        uart_write(&checksum, 1);
     }
-    uart_write(&packet->checksum, 1);
-    // We could use a loop here to avoid string.h
-    memcpy(&last_tx_packet, packet, sizeof(Packet));
+    last_tx_cmd = cmd;
+    last_tx_data = data;
+    last_tx_len = len;
+}
+
+static void comms_write_control(uint8_t cmd, uint8_t data, uint16_t len) {
+    control_data = data;
+    comms_write_frame(cmd, &control_data, len);
+}
+
+bool comms_write_done() {
+    return uart_tx_done();
 }
 
-void comms_read(Packet *packet) {
-    // We could use a loop here
-    memcpy(packet, &packet_buffer[packet_read_index], sizeof(Packet));
-    packet_read_index = (packet_read_index + 1) & packet_buffer_mask;
+// Oldest received packet, or NULL. It is lent out and stays valid until
+// comms_release(), the parser only writes to free slots.
+const Packet *comms_peek() {
+    if (packet_read_index == packet_write_index) {
+        return NULL;
+    }
+    return &packet_buffer[packet_read_index];
+}
+
+void comms_release() {
+    if (packet_read_index != packet_write_index) {
+        packet_read_index = (packet_read_index + 1) & packet_buffer_mask;
+    }
+}
+
+void comms_get_stats(CommsStats *out) {
+    *out = stats;
 }
 
 uint32_t big_endian_to_uint32(const uint8_t *bytes) {
     return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
 }
 
-uint8_t crc8(const uint8_t *data, uint8_t len) {
+static uint8_t calculate_checksum(uint8_t cmd, const uint8_t *data, uint16_t len) {
+    uint8_t len8 = (uint8_t)len;
     uint8_t crc = 0;
-    for (uint8_t i = 0; i < len; i++) {
-        crc ^= data[i];
-        for (uint8_t j = 0; j < 8; j++) {
-            if (crc & 0x80) {
-                crc = (crc << 1) ^ 0x07;
-            } else {
-                crc <<= 1;
-            }
-        }
-    }
+    crc ^= crc8(&cmd, 1);
+    crc ^= crc8(&len8, 1);
+    crc ^= crc8(data, len);
     return crc;
 }
 
-uint8_t calculate_checksum(const Packet *packet) {
-    uint8_t crc = 0;
-    crc ^= crc8((uint8_t *)&packet->cmd, 1);
-    crc ^= crc8((uint8_t *)&packet->len, 1);
-    crc ^= crc8(packet->data, packet->len);
-    return crc;
+static uint32_t calculate_crc32(uint8_t cmd, const uint8_t *data, uint16_t len) {
+    uint8_t header[FRAME_V2_HEADER_LEN] = {cmd, (uint8_t)(len >> 8), (uint8_t)len};
+    uint32_t crc = crc32_update(CRC32_INIT, header, sizeof(header));
+    crc = crc32_update(crc, data, len);
+    return ~crc;
 }
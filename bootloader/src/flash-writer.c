@@ -0,0 +1,223 @@
+#include <string.h>
+#include "flash-writer.h"
+#include "bootloader.h"
+#include "mem-ops.h"
+#include "trace.h"
+#include "sys-time.h"
+#include "common.h"
+
+#define PAGE_MASK (~(uint32_t)(FLASH_PAGE_SIZE - 1))
+
+// flash_writer_ready() has to be able to say yes to the largest packet
+_Static_assert(IS_POWER_OF_TWO(FLASH_WRITER_PAGES) &&
+               MAX_FRAME_DATA_LEN / FLASH_PAGE_SIZE + 2 < FLASH_WRITER_PAGES,
+               "FLASH_WRITER_PAGES must be a power of two above one packet");
+
+typedef struct {
+    uint32_t addr;
+    uint8_t data[FLASH_PAGE_SIZE];
+} FlashPage;
+
+// Pages are programmed in order from read_index. The page at read_index is
+// the one in the eNVM controller while programming is true. The page at
+// write_index collects data while page_open is true and is only queued once
+// it is complete, another page is written or the writer is flushed.
+static FlashPage pages[FLASH_WRITER_PAGES];
+static uint32_t read_index = 0;
+static uint32_t write_index = 0;
+static uint32_t pages_mask = FLASH_WRITER_PAGES - 1;
+static bool programming = false;
+static bool page_open = false;
+static uint32_t page_fill = 0;  // Bytes written in order into the open page
+static nvm_status_t status = NVM_SUCCESS;
+static uint32_t program_start = 0;  // Cycle count when the current page started
+static uint64_t program_start_us = 0;
+static FlashWriterStats stats = {0};
+
+static uint32_t flash_writer_used_pages(void);
+static FlashPage *flash_writer_find_page(uint32_t page_addr);
+static void flash_writer_open_page(uint32_t page_addr, uint32_t offset);
+static void flash_writer_close_page(void);
+static bool flash_writer_is_uniform(const uint8_t *data, uint8_t pattern);
+
+void flash_writer_init(void) {
+    read_index = 0;
+    write_index = 0;
+    programming = false;
+    page_open = false;
+    page_fill = 0;
+    status = NVM_SUCCESS;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void flash_writer_update(void) {
+    if (programming) {
+        if (NVM_write_page_poll()) {
+            return;
+        }
+        nvm_status_t page_status = NVM_write_page_complete();
+        uint32_t program_us = (uint32_t)(sys_time_get_us() - program_start_us);
+        if (program_us > stats.program_max_us) {
+            stats.program_max_us = program_us;
+        }
+        stats.pages_programmed++;
+        if (page_status != NVM_SUCCESS) {
+            stats.errors++;
+            if (status == NVM_SUCCESS) {
+                status = page_status;
+            }
+        }
+        programming = false;
+        read_index = (read_index + 1) & pages_mask;
+        trace_record(TRACE_NVM_PAGE, program_start);
+    }
+    if (read_index != write_index) {
+        FlashPage *page = &pages[read_index];
+        program_start = trace_now();
+        program_start_us = sys_time_get_us();
+        nvm_status_t start_status =
+            NVM_write_page_start(page->addr, page->data, NVM_DO_NOT_LOCK_PAGE);
+        if (start_status == NVM_SUCCESS) {
+            programming = true;
+        } else {
+            stats.errors++;
+            if (status == NVM_SUCCESS) {
+                status = start_status;
+            }
+            read_index = (read_index + 1) & pages_mask;
+        }
+    }
+}
+
+bool flash_writer_ready(uint32_t len) {
+    // An unaligned write touches one page more than its length suggests
+    uint32_t needed = len / FLASH_PAGE_SIZE + 2;
+    // One slot is kept empty to tell a full queue from an empty one
+    return flash_writer_used_pages() + needed < FLASH_WRITER_PAGES;
+}
+
+bool flash_writer_write(uint32_t addr, const uint8_t *data, uint32_t len) {
+    if (!flash_writer_ready(len)) {
+        return false;
+    }
+    while (len > 0) {
+        uint32_t page_addr = addr & PAGE_MASK;
+        uint32_t offset = addr - page_addr;
+        uint32_t chunk = FLASH_PAGE_SIZE - offset;
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (page_open && pages[write_index].addr != page_addr) {
+            flash_writer_close_page();
+        }
+        if (!page_open) {
+            flash_writer_open_page(page_addr, offset);
+        }
+        mem_copy(&pages[write_index].data[offset], data, chunk);
+        if (offset == page_fill) {
+            page_fill += chunk;
+        }
+        if (page_fill == FLASH_PAGE_SIZE) {
+            flash_writer_close_page();
+        }
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Sets a whole page to one byte value. A page that already reads back as
+// the pattern and has nothing staged for it is not programmed again.
+bool flash_writer_fill(uint32_t page_addr, uint8_t pattern) {
+    if (!flash_writer_ready(FLASH_PAGE_SIZE)) {
+        return false;
+    }
+    if (page_open && pages[write_index].addr != page_addr) {
+        flash_writer_close_page();
+    }
+    if (!page_open && flash_writer_find_page(page_addr) == NULL &&
+        flash_writer_is_uniform(NVM_PTR(page_addr), pattern)) {
+        return true;
+    }
+    if (!page_open) {
+        flash_writer_open_page(page_addr, 0);
+    }
+    mem_fill(pages[write_index].data, pattern, FLASH_PAGE_SIZE);
+    page_fill = FLASH_PAGE_SIZE;
+    flash_writer_close_page();
+    return true;
+}
+
+bool flash_writer_idle(void) {
+    return !programming && !page_open && read_index == write_index;
+}
+
+nvm_status_t flash_writer_status(void) {
+    return status;
+}
+
+// Programs the queued pages, the open one keeps collecting data
+nvm_status_t flash_writer_drain(void) {
+    while (programming || read_index != write_index) {
+        flash_writer_update();
+    }
+    return status;
+}
+
+nvm_status_t flash_writer_flush(void) {
+    if (page_open) {
+        flash_writer_close_page();
+    }
+    return flash_writer_drain();
+}
+
+void flash_writer_get_stats(FlashWriterStats *out) {
+    *out = stats;
+}
+
+static uint32_t flash_writer_used_pages(void) {
+    return ((write_index - read_index) & pages_mask) + (page_open ? 1 : 0);
+}
+
+static FlashPage *flash_writer_find_page(uint32_t page_addr) {
+    // Newest first, so a partial page builds on the latest queued content
+    uint32_t index = write_index;
+    while (index != read_index) {
+        index = (index - 1) & pages_mask;
+        if (pages[index].addr == page_addr) {
+            return &pages[index];
+        }
+    }
+    return NULL;
+}
+
+static void flash_writer_open_page(uint32_t page_addr, uint32_t offset) {
+    FlashPage *page = &pages[write_index];
+    if (offset == 0) {
+        // Whatever the image does not cover is left erased
+        mem_fill(page->data, 0xFF, FLASH_PAGE_SIZE);
+    } else {
+        // Unusual write into the middle of a page, keep what is before it
+        FlashPage *pending = flash_writer_find_page(page_addr);
+        const uint8_t *base = pending ? pending->data : NVM_PTR(page_addr);
+        mem_copy(page->data, base, FLASH_PAGE_SIZE);
+    }
+    page->addr = page_addr;
+    page_fill = offset;
+    page_open = true;
+}
+
+static void flash_writer_close_page(void) {
+    write_index = (write_index + 1) & pages_mask;
+    page_open = false;
+}
+
+static bool flash_writer_is_uniform(const uint8_t *data, uint8_t pattern) {
+    for (uint32_t i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if (data[i] != pattern) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,195 @@
+#include "image.h"
+#include "sha256.h"
+#include "mem-ops.h"
+#include "sys-time.h"
+#include "trace.h"
+#include "CMSIS/m2sxxx.h"
+#include "drivers/mss_sys_services/mss_sys_services.h"
+
+_Static_assert(sizeof(ImageHeader) <= IMAGE_HEADER_SIZE,
+               "ImageHeader must fit in front of the vectors");
+
+static uint32_t verify_time_us = 0;
+// Digest of each slot already checked since its last write
+static bool verified[APP_SLOT_COUNT] = {false};
+
+// Running digest of the image bytes as they are accepted during an update
+static Sha256 stream;
+static uint8_t stream_slot = 0;
+static uint32_t stream_next_addr = 0;
+static bool stream_valid = false;
+
+static const ImageHeader *image_header(uint8_t slot);
+static bool image_sections_valid(const ImageHeader *header);
+static bool image_hash_flash(uint8_t slot, const ImageHeader *header,
+                             uint8_t digest[IMAGE_DIGEST_LEN]);
+
+void image_init(void) {
+    MSS_SYS_init(MSS_SYS_NO_EVENT_HANDLER);
+}
+
+void image_deinit(void) {
+    // The app brings its own vector table, do not leave the COMBLK armed
+    NVIC_DisableIRQ(ComBlk_IRQn);
+    NVIC_ClearPendingIRQ(ComBlk_IRQn);
+}
+
+bool image_verify(uint8_t slot) {
+    if (slot >= APP_SLOT_COUNT) {
+        return false;
+    }
+    if (verified[slot]) {
+        return true;
+    }
+    const ImageHeader *header = image_header(slot);
+    if (header == NULL) {
+        return false;
+    }
+    uint8_t digest[IMAGE_DIGEST_LEN];
+    uint32_t trace_start = trace_now();
+    uint64_t start = sys_time_get_us();
+    bool ok = image_hash_flash(slot, header, digest);
+    verify_time_us = (uint32_t)(sys_time_get_us() - start);
+    trace_record(TRACE_IMAGE_CHECK, trace_start);
+    verified[slot] = ok && memcmp(digest, header->digest, IMAGE_DIGEST_LEN) == 0;
+    return verified[slot];
+}
+
+// Only meaningful for a slot that passed image_verify()
+uint32_t image_get_version(uint8_t slot) {
+    const ImageHeader *header = image_header(slot);
+    if (header == NULL) {
+        return 0;
+    }
+    return header->image_version;
+}
+
+uint32_t image_verify_time_us(void) {
+    return verify_time_us;
+}
+
+// Puts the sections the app runs from the eSRAM in place, right before the
+// jump. Only for a slot that passed image_verify().
+uint32_t image_load_ram_code(uint8_t slot) {
+    const ImageHeader *header = image_header(slot);
+    if (header == NULL || (header->flags & IMAGE_FLAG_RAM_CODE) == 0) {
+        return 0;
+    }
+    uint32_t copied = 0;
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        const ImageSection *section = &header->sections[i];
+        mem_copy(ESRAM_PTR(section->run_addr),
+                 NVM_PTR(APP_VECTORS_ADDR(slot) + section->offset), section->len);
+        copied += section->len;
+    }
+    // The next instruction fetches may come from there
+    __DSB();
+    __ISB();
+    return copied;
+}
+
+// The slot is about to be written, its old image no longer counts
+void image_stream_begin(uint8_t slot) {
+    sha256_init(&stream);
+    stream_slot = slot;
+    stream_next_addr = APP_VECTORS_ADDR(slot);
+    stream_valid = true;
+    verified[slot] = false;
+}
+
+void image_stream_update(uint32_t addr, const uint8_t *data, uint32_t len) {
+    // The header is not part of the digest
+    if (addr < APP_VECTORS_ADDR(stream_slot)) {
+        uint32_t skip = APP_VECTORS_ADDR(stream_slot) - addr;
+        if (skip >= len) {
+            return;
+        }
+        addr += skip;
+        data += skip;
+        len -= skip;
+    }
+    if (addr != stream_next_addr) {
+        // Out of order data, image_commit() falls back to the hardware hash
+        stream_valid = false;
+        return;
+    }
+    uint32_t start = trace_now();
+    sha256_update(&stream, data, len);
+    stream_next_addr += len;
+    trace_record(TRACE_SHA256, start);
+}
+
+// Checks the slot given to image_stream_begin()
+bool image_commit(const uint8_t expected[IMAGE_DIGEST_LEN]) {
+    const ImageHeader *header = image_header(stream_slot);
+    if (header == NULL) {
+        return false;
+    }
+    uint8_t digest[IMAGE_DIGEST_LEN];
+    uint32_t trace_start = trace_now();
+    uint64_t start = sys_time_get_us();
+    bool ok = true;
+    if (stream_valid &&
+        stream_next_addr == APP_VECTORS_ADDR(stream_slot) + header->image_len) {
+        // Only the last partial block is left to hash
+        sha256_final(&stream, digest);
+        stream_valid = false;
+    } else {
+        ok = image_hash_flash(stream_slot, header, digest);
+    }
+    verify_time_us = (uint32_t)(sys_time_get_us() - start);
+    trace_record(TRACE_IMAGE_CHECK, trace_start);
+    // The header digest must agree too, it is what the next boot checks
+    verified[stream_slot] = ok && memcmp(digest, expected, IMAGE_DIGEST_LEN) == 0 &&
+                            memcmp(digest, header->digest, IMAGE_DIGEST_LEN) == 0;
+    return verified[stream_slot];
+}
+
+static const ImageHeader *image_header(uint8_t slot) {
+    const ImageHeader *header = (const ImageHeader *)NVM_PTR(APP_SLOT_ADDR(slot));
+    if (header->magic != IMAGE_MAGIC) {
+        return NULL;
+    }
+    // An image is linked for one slot, it must not run from the other
+    if (header->header_version != IMAGE_HEADER_VERSION ||
+        header->load_addr != APP_SLOT_ADDR(slot)) {
+        return NULL;
+    }
+    if (header->image_len == 0 ||
+        header->image_len > FW_MAX_SIZE - IMAGE_HEADER_SIZE ||
+        !image_sections_valid(header)) {
+        return NULL;
+    }
+    return header;
+}
+
+// A bad table must not let the copy overwrite the bootloader's own RAM
+static bool image_sections_valid(const ImageHeader *header) {
+    if ((header->flags & IMAGE_FLAG_RAM_CODE) == 0) {
+        return true;
+    }
+    if (header->section_count > IMAGE_MAX_SECTIONS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        const ImageSection *section = &header->sections[i];
+        if (((section->offset | section->run_addr | section->len) & 3) != 0 ||
+            section->offset > header->image_len ||
+            section->len > header->image_len - section->offset ||
+            section->run_addr < APP_RAM_CODE_ADDR ||
+            section->len > APP_RAM_CODE_SIZE ||
+            section->run_addr - APP_RAM_CODE_ADDR > APP_RAM_CODE_SIZE - section->len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool image_hash_flash(uint8_t slot, const ImageHeader *header,
+                             uint8_t digest[IMAGE_DIGEST_LEN]) {
+    // Only the image itself is hashed, not the whole slot
+    const uint8_t *image = (const uint8_t *)(uintptr_t)(NVM_ABS_ADDRESS +
+                                                        APP_VECTORS_ADDR(slot));
+    return MSS_SYS_sha256(image, header->image_len * 8, digest) ==
+           MSS_SYS_SUCCESS;
+}
@@ -0,0 +1,126 @@
+#include "lz.h"
+
+#define LZ_WINDOW_MASK (LZ_WINDOW_SIZE - 1)
+#define LZ_NIBBLE_MAX  15
+#define LZ_LEN_MORE    255
+
+static bool lz_needs_input(const Lz *lz);
+static void lz_emit(Lz *lz, uint8_t byte, uint8_t *out, uint32_t *out_count);
+
+void lz_init(Lz *lz, uint32_t out_len) {
+    lz->out_pos = 0;
+    lz->out_len = out_len;
+    lz->state = (out_len > 0) ? LZ_STATE_TOKEN : LZ_STATE_DONE;
+    lz->token = 0;
+    lz->literal_len = 0;
+    lz->match_len = 0;
+    lz->offset = 0;
+}
+
+uint32_t lz_decode(Lz *lz, const uint8_t *in, uint32_t in_len,
+                   uint32_t *consumed, uint8_t *out, uint32_t out_cap) {
+    uint32_t in_count = 0;
+    uint32_t out_count = 0;
+    while (out_count < out_cap && lz->state != LZ_STATE_DONE &&
+           lz->state != LZ_STATE_ERROR) {
+        if (lz_needs_input(lz) && in_count == in_len) {
+            break;
+        }
+        switch (lz->state) {
+            case LZ_STATE_TOKEN:
+                lz->token = in[in_count++];
+                lz->literal_len = lz->token >> 4;
+                lz->match_len = lz->token & 0x0F;
+                lz->state = (lz->literal_len == LZ_NIBBLE_MAX)
+                                ? LZ_STATE_LITERAL_LEN
+                                : LZ_STATE_LITERALS;
+                break;
+            case LZ_STATE_LITERAL_LEN: {
+                uint8_t more = in[in_count++];
+                lz->literal_len += more;
+                if (more != LZ_LEN_MORE) {
+                    lz->state = LZ_STATE_LITERALS;
+                }
+                break;
+            }
+            case LZ_STATE_LITERALS:
+                if (lz->literal_len == 0) {
+                    // The final sequence has no match
+                    lz->state = (lz->out_pos == lz->out_len) ? LZ_STATE_DONE
+                                                             : LZ_STATE_OFFSET_LO;
+                    break;
+                }
+                lz_emit(lz, in[in_count++], out, &out_count);
+                lz->literal_len--;
+                break;
+            case LZ_STATE_OFFSET_LO:
+                lz->offset = in[in_count++];
+                lz->state = LZ_STATE_OFFSET_HI;
+                break;
+            case LZ_STATE_OFFSET_HI:
+                lz->offset |= (uint32_t)in[in_count++] << 8;
+                if (lz->offset == 0 || lz->offset > LZ_WINDOW_SIZE ||
+                    lz->offset > lz->out_pos) {
+                    lz->state = LZ_STATE_ERROR;
+                    break;
+                }
+                lz->state = (lz->match_len == LZ_NIBBLE_MAX) ? LZ_STATE_MATCH_LEN
+                                                             : LZ_STATE_MATCH;
+                lz->match_len += LZ_MIN_MATCH;
+                break;
+            case LZ_STATE_MATCH_LEN: {
+                uint8_t more = in[in_count++];
+                lz->match_len += more;
+                if (more != LZ_LEN_MORE) {
+                    lz->state = LZ_STATE_MATCH;
+                }
+                break;
+            }
+            case LZ_STATE_MATCH:
+                if (lz->match_len == 0) {
+                    lz->state = (lz->out_pos == lz->out_len) ? LZ_STATE_DONE
+                                                             : LZ_STATE_TOKEN;
+                    break;
+                }
+                lz_emit(lz, lz->history[(lz->out_pos - lz->offset) & LZ_WINDOW_MASK],
+                        out, &out_count);
+                lz->match_len--;
+                break;
+            default:
+                lz->state = LZ_STATE_ERROR;
+                break;
+        }
+    }
+    *consumed = in_count;
+    return out_count;
+}
+
+bool lz_done(const Lz *lz) {
+    return lz->state == LZ_STATE_DONE;
+}
+
+bool lz_failed(const Lz *lz) {
+    return lz->state == LZ_STATE_ERROR;
+}
+
+static bool lz_needs_input(const Lz *lz) {
+    switch (lz->state) {
+        case LZ_STATE_LITERALS:
+            return lz->literal_len > 0;
+        case LZ_STATE_MATCH:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void lz_emit(Lz *lz, uint8_t byte, uint8_t *out, uint32_t *out_count) {
+    if (lz->out_pos == lz->out_len) {
+        // More data than the header promised
+        lz->state = LZ_STATE_ERROR;
+        return;
+    }
+    lz->history[lz->out_pos & LZ_WINDOW_MASK] = byte;
+    lz->out_pos++;
+    out[(*out_count)++] = byte;
+}
@@ -7,36 +7,75 @@
 #include "uart.h"
 #include "comms.h"
 #include "bootloader.h"
+#include "flash-writer.h"
+#include "image.h"
+#include "slot.h"
 #include "sys-time.h"
+#include "trace.h"
+#include "boot-request.h"
 
-void jump_to_app(void) {
-    uint32_t *reset_vector_entry = (uint32_t *)(APP_START_ADDR + 4U);
+void jump_to_app(uint8_t slot) {
+    uint32_t *reset_vector_entry = (uint32_t *)(APP_VECTORS_ADDR(slot) + 4U);
     uint32_t *reset_vector = (uint32_t *)*reset_vector_entry;
-    SCB->VTOR = APP_START_ADDR;
+    SCB->VTOR = APP_VECTORS_ADDR(slot);
     void (*app_reset_handler)(void) = (void (*)(void))reset_vector;
     app_reset_handler();
 }
 
+static void boot_app(uint8_t slot) {
+    image_load_ram_code(slot);
+    image_deinit();
+    uart_deinit();
+    sys_time_deinit();
+    jump_to_app(slot);
+}
+
 int main() {
+    trace_init();
     sys_time_init();
     uart_init();
     led_init();
+    image_init();
+    // The blink and the sync wait are only for when an update is wanted
+    BootRequest request = boot_request_check();
+    if (request == BOOT_REQUEST_NONE) {
+        // Already checked, slot_boot() only looks it up again
+        boot_app(slot_boot());
+    }
     comms_init();
     bl_state_machine_init();
-    for (int i = 0; i < 4; i++) {
-        led_toggle(LED_SYNC);
-        sys_time_delay_ms(50);
+    if (request == BOOT_REQUEST_APP) {
+        const BootMailbox *mailbox = boot_request_mailbox();
+        if (mailbox->baud != 0) {
+            uart_set_baud(mailbox->baud);
+        }
+        bl_skip_sync(mailbox->image_len);
+    } else {
+        for (int i = 0; i < 4; i++) {
+            led_toggle(LED_SYNC);
+            sys_time_delay_ms(50);
+        }
     }
     while (1) {
         if (!bl_need_sync()) {
             // Only update comms when are already synced
             comms_update();
         }
+        // Keep pages programming in the background while packets arrive
+        flash_writer_update();
         bl_state_machine_update();
         if (bl_is_done()) {
-            uart_deinit();
-            sys_time_deinit();
-            jump_to_app();
+            uint8_t slot = slot_boot();
+            if (slot == SLOT_NONE) {
+                // Never run an image we cannot vouch for, wait for a new one
+                led_set(LED_ERROR, 1);
+                // The host starts over with a sync at the default rate
+                uart_set_baud(UART_DEFAULT_BAUD);
+                comms_init();
+                bl_state_machine_init();
+                continue;
+            }
+            boot_app(slot);
         }
     }
 }
@@ -1,5 +1,16 @@
+#include <string.h>
 #include "ring-buffer.h"
 
+// The other side's index is loaded with acquire so the buffer access stays
+// behind it, our own is stored with release so the buffer access stays
+// ahead of it. On the Cortex-M3 that is a DMB, on the host it also holds
+// between threads.
+#define RING_LOAD(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define RING_STORE(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+static uint32_t ring_buffer_copy_out(RingBuffer* rb, uint32_t read_index,
+                                     uint8_t* data, uint32_t len);
+
 void ring_buffer_init(RingBuffer* rb, uint8_t* buffer, uint32_t size) {
     rb->buffer = buffer;
     rb->read_index = 0;
@@ -8,34 +19,114 @@ void ring_buffer_init(RingBuffer* rb, uint8_t* buffer, uint32_t size) {
 }
 
 bool ring_buffer_empty(RingBuffer* rb) {
-    return rb->read_index == rb->write_index;
+    return rb->read_index == RING_LOAD(rb->write_index);
 }
 
-bool ring_buffer_read(RingBuffer* rb, uint8_t* byte) {
-    uint32_t local_read_index = rb->read_index;
+// Bytes waiting to be read, exact on the consumer side
+uint32_t ring_buffer_count(RingBuffer* rb) {
+    return (RING_LOAD(rb->write_index) - rb->read_index) & rb->mask;
+}
+
+// Bytes that can be written, exact on the producer side
+uint32_t ring_buffer_space(RingBuffer* rb) {
+    return (RING_LOAD(rb->read_index) - rb->write_index - 1) & rb->mask;
+}
+
+bool ring_buffer_write(RingBuffer* rb, uint8_t byte) {
     uint32_t local_write_index = rb->write_index;
+    uint32_t next_write_index = (local_write_index + 1) & rb->mask;
 
-    if (local_read_index == local_write_index) {
+    if (next_write_index == RING_LOAD(rb->read_index)) {
         return false;
     }
-
-    *byte = rb->buffer[local_read_index];
-    local_read_index = (local_read_index + 1) & rb->mask;
-    rb->read_index = local_read_index;
+    rb->buffer[local_write_index] = byte;
+    RING_STORE(rb->write_index, next_write_index);
     return true;
 }
 
-bool ring_buffer_write(RingBuffer* rb, uint8_t byte) {
+// Writes as much of data as fits and returns how much that was
+uint32_t ring_buffer_write_n(RingBuffer* rb, const uint8_t* data, uint32_t len) {
+    uint32_t written = 0;
+    while (written < len) {
+        uint8_t* span;
+        uint32_t chunk = ring_buffer_write_span(rb, &span);
+        if (chunk == 0) {
+            break;
+        }
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+        memcpy(span, &data[written], chunk);
+        ring_buffer_commit(rb, chunk);
+        written += chunk;
+    }
+    return written;
+}
+
+// Contiguous free space at the write index, to fill in place and then
+// publish with ring_buffer_commit()
+uint32_t ring_buffer_write_span(RingBuffer* rb, uint8_t** span) {
     uint32_t local_write_index = rb->write_index;
-    uint32_t local_read_index = rb->read_index;
+    uint32_t space = (RING_LOAD(rb->read_index) - local_write_index - 1) & rb->mask;
+    uint32_t to_end = rb->mask + 1 - local_write_index;
+    *span = &rb->buffer[local_write_index];
+    return (space < to_end) ? space : to_end;
+}
 
-    uint32_t next_write_index = (local_write_index + 1) & rb->mask;
+void ring_buffer_commit(RingBuffer* rb, uint32_t len) {
+    RING_STORE(rb->write_index, (rb->write_index + len) & rb->mask);
+}
 
-    if (next_write_index == local_read_index) {
+bool ring_buffer_read(RingBuffer* rb, uint8_t* byte) {
+    uint32_t local_read_index = rb->read_index;
+
+    if (local_read_index == RING_LOAD(rb->write_index)) {
         return false;
     }
-
-    rb->buffer[local_write_index] = byte;
-    rb->write_index = next_write_index;
+    *byte = rb->buffer[local_read_index];
+    RING_STORE(rb->read_index, (local_read_index + 1) & rb->mask);
     return true;
 }
+
+// Reads up to len bytes and returns how many there were
+uint32_t ring_buffer_read_n(RingBuffer* rb, uint8_t* data, uint32_t len) {
+    uint32_t local_read_index = rb->read_index;
+    uint32_t copied = ring_buffer_copy_out(rb, local_read_index, data, len);
+    RING_STORE(rb->read_index, (local_read_index + copied) & rb->mask);
+    return copied;
+}
+
+// Like ring_buffer_read_n() but leaves the bytes in the ring
+uint32_t ring_buffer_peek(RingBuffer* rb, uint8_t* data, uint32_t len) {
+    return ring_buffer_copy_out(rb, rb->read_index, data, len);
+}
+
+// Contiguous readable bytes at the read index, to use in place and then
+// give back with ring_buffer_consume()
+uint32_t ring_buffer_read_span(RingBuffer* rb, const uint8_t** span) {
+    uint32_t local_read_index = rb->read_index;
+    uint32_t count = (RING_LOAD(rb->write_index) - local_read_index) & rb->mask;
+    uint32_t to_end = rb->mask + 1 - local_read_index;
+    *span = &rb->buffer[local_read_index];
+    return (count < to_end) ? count : to_end;
+}
+
+void ring_buffer_consume(RingBuffer* rb, uint32_t len) {
+    RING_STORE(rb->read_index, (rb->read_index + len) & rb->mask);
+}
+
+static uint32_t ring_buffer_copy_out(RingBuffer* rb, uint32_t read_index,
+                                     uint8_t* data, uint32_t len) {
+    uint32_t count = (RING_LOAD(rb->write_index) - read_index) & rb->mask;
+    if (len > count) {
+        len = count;
+    }
+    // At most two pieces, up to the end of the buffer and from its start
+    uint32_t first = rb->mask + 1 - read_index;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, &rb->buffer[read_index], first);
+    memcpy(&data[first], rb->buffer, len - first);
+    return len;
+}
@@ -0,0 +1,93 @@
+#include "slot.h"
+#include "image.h"
+#include "flash-writer.h"
+
+#define SLOT_META_PAGES (BOOT_META_SIZE / FLASH_PAGE_SIZE)
+
+_Static_assert(BOOT_META_ADDR % FLASH_PAGE_SIZE == 0 && SLOT_META_PAGES > 0,
+               "The slot records need whole eNVM pages");
+_Static_assert(APP_SLOT_SIZE % 0x200 == 0,
+               "VTOR needs the vectors of every slot 512-byte aligned");
+
+static uint32_t slot_meta_check(const SlotMeta *meta);
+static const SlotMeta *slot_meta_newest(uint32_t *page);
+
+// The slot to start, SLOT_NONE if none passes image_verify(). Checks at most
+// the recorded slot on a normal boot, the digests are kept once checked.
+uint8_t slot_boot(void) {
+    const SlotMeta *meta = slot_meta_newest(NULL);
+    if (meta != NULL && image_verify(meta->slot)) {
+        return meta->slot;
+    }
+    uint8_t best = SLOT_NONE;
+    for (uint8_t slot = 0; slot < APP_SLOT_COUNT; slot++) {
+        if (image_verify(slot) &&
+            (best == SLOT_NONE || image_get_version(slot) > image_get_version(best))) {
+            best = slot;
+        }
+    }
+    return best;
+}
+
+// Never the slot that would start now, so a failed update leaves it alone
+uint8_t slot_update_target(void) {
+    uint8_t running = slot_boot();
+    if (running == SLOT_NONE) {
+        return 0;
+    }
+    return (running + 1) % APP_SLOT_COUNT;
+}
+
+// Makes a checked slot the one to start. Needs the flash writer to itself,
+// it is flushed before this returns.
+bool slot_select(uint8_t slot) {
+    if (!image_verify(slot)) {
+        return false;
+    }
+    uint32_t page = SLOT_META_PAGES - 1;
+    const SlotMeta *newest = slot_meta_newest(&page);
+    if (newest != NULL && newest->slot == slot) {
+        return true;
+    }
+    uint8_t buf[FLASH_PAGE_SIZE];
+    memset(buf, 0xFF, sizeof(buf));
+    SlotMeta meta = {
+        .magic = SLOT_META_MAGIC,
+        .sequence = (newest != NULL) ? newest->sequence + 1 : 0,
+        .slot = slot,
+    };
+    meta.check = slot_meta_check(&meta);
+    memcpy(buf, &meta, sizeof(meta));
+    page = (page + 1) % SLOT_META_PAGES;
+    if (!flash_writer_write(BOOT_META_ADDR + page * FLASH_PAGE_SIZE, buf,
+                            sizeof(buf))) {
+        return false;
+    }
+    return flash_writer_flush() == NVM_SUCCESS;
+}
+
+// Erased eNVM must not pass for a record
+static uint32_t slot_meta_check(const SlotMeta *meta) {
+    return ~(meta->magic ^ meta->sequence ^ meta->slot);
+}
+
+// The record in charge and its page, NULL if there is none
+static const SlotMeta *slot_meta_newest(uint32_t *page) {
+    const SlotMeta *newest = NULL;
+    for (uint32_t i = 0; i < SLOT_META_PAGES; i++) {
+        const SlotMeta *meta =
+            (const SlotMeta *)NVM_PTR(BOOT_META_ADDR + i * FLASH_PAGE_SIZE);
+        if (meta->magic != SLOT_META_MAGIC ||
+            meta->check != slot_meta_check(meta) ||
+            meta->slot >= APP_SLOT_COUNT) {
+            continue;
+        }
+        if (newest == NULL || meta->sequence > newest->sequence) {
+            newest = meta;
+            if (page != NULL) {
+                *page = i;
+            }
+        }
+    }
+    return newest;
+}
@@ -22,6 +22,17 @@ uint64_t sys_time_get_ticks(void) {
     return tick;
 }
 
+uint64_t sys_time_get_us(void) {
+    uint64_t ms;
+    uint32_t val;
+    // Retry if the tick interrupt lands between the two reads
+    do {
+        ms = tick;
+        val = SysTick->VAL;
+    } while (ms != tick);
+    return ms * 1000 + (SysTick->LOAD - val) / (SystemCoreClock / 1000000);
+}
+
 void sys_time_delay_ms(uint32_t ms) {
     uint64_t end = tick + ms;
     while (tick < end);
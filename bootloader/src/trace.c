@@ -0,0 +1,79 @@
+#include <string.h>
+#include "trace.h"
+#include "common.h"
+#include "CMSIS/m2sxxx.h"
+
+#if TRACE_ENABLED
+
+#define TRACE_MASK (TRACE_RECORDS - 1)
+
+_Static_assert(IS_POWER_OF_TWO(TRACE_RECORDS) && TRACE_RECORDS <= 0x10000,
+               "TRACE_RECORDS must be a power of two, indexed with 16 bits");
+
+static TraceRecord records[TRACE_RECORDS];
+static TraceTotals totals[TRACE_NUM_EVENTS];
+static uint32_t written = 0;  // Records ever written, the ring index is the low bits
+
+void trace_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    trace_reset();
+}
+
+void trace_reset(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    written = 0;
+    memset(totals, 0, sizeof(totals));
+    __set_PRIMASK(primask);
+}
+
+uint32_t trace_now(void) {
+    return DWT->CYCCNT;
+}
+
+// Also called from interrupts, the record slot is claimed with them masked
+void trace_record(TraceEvent event, uint32_t start) {
+    uint32_t cycles = DWT->CYCCNT - start;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    TraceRecord *record = &records[written & TRACE_MASK];
+    record->start = start;
+    record->cycles = cycles;
+    record->event = event;
+    written++;
+    TraceTotals *t = &totals[event];
+    t->count++;
+    t->total += cycles;
+    if (cycles > t->max) {
+        t->max = cycles;
+    }
+    __set_PRIMASK(primask);
+}
+
+uint32_t trace_written(void) {
+    return written;
+}
+
+// Index 0 is the oldest record still in the ring
+bool trace_get(uint32_t index, TraceRecord *out) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t kept = (written < TRACE_RECORDS) ? written : TRACE_RECORDS;
+    bool found = index < kept;
+    if (found) {
+        *out = records[(written - kept + index) & TRACE_MASK];
+    }
+    __set_PRIMASK(primask);
+    return found;
+}
+
+void trace_get_totals(TraceEvent event, TraceTotals *out) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = totals[event];
+    __set_PRIMASK(primask);
+}
+
+#endif // TRACE_ENABLED
@@ -1,31 +1,129 @@
+#include <string.h>
 #include "uart.h"
 #include "ring-buffer.h"
+#include "common.h"
+#include "trace.h"
+#include "CMSIS/system_m2sxxx.h"
 #include "drivers/mss_uart/mss_uart.h"
 
-#define BAUD_RATE MSS_UART_921600_BAUD
-#define RING_BUFFER_SIZE (128)
+// Worst baud rate error accepted from the fractional divider, in 1/1000
+#define BAUD_MAX_ERROR (20)
+#define RX_FIFO_SIZE (16)
+// Interrupt at half a FIFO, leaving 8 byte times of latency headroom
+#define RX_TRIGGER_LEVEL MSS_UART_FIFO_EIGHT_BYTES
+// Flush a partly filled FIFO after 4 x 8 = 32 idle bit times
+#define RX_TIMEOUT (8)
+#define TX_BUFFER_MASK (UART_TX_BUFFER_SIZE - 1)
+
+_Static_assert(IS_POWER_OF_TWO(UART_RX_BUFFER_SIZE) &&
+               UART_RX_BUFFER_SIZE >= RX_FIFO_SIZE,
+               "UART_RX_BUFFER_SIZE must be a power of two, at least one FIFO");
+_Static_assert(IS_POWER_OF_TWO(UART_TX_BUFFER_SIZE),
+               "UART_TX_BUFFER_SIZE must be a power of two");
 
 static RingBuffer rb = {0U};
-static uint8_t data_buffer[RING_BUFFER_SIZE] = {0U};
+static uint8_t data_buffer[UART_RX_BUFFER_SIZE] = {0U};
+static UartStats stats = {0U};
+static uint32_t baud_rate = UART_DEFAULT_BAUD;
+
+// Bytes from tx_tail up to tx_head are waiting for the TX interrupt.
+// Only uart_write() moves tx_head and only uart_tx_handler() moves tx_tail.
+static uint8_t tx_buffer[UART_TX_BUFFER_SIZE] = {0U};
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+static void uart_configure(uint32_t baud);
 
 static void uart_rx_handler(mss_uart_instance_t *this_uart) {
-    uint8_t rx_buff;
-    size_t size = MSS_UART_get_rx(this_uart, &rx_buff, 1);
-    if (size > 0) {
-        ring_buffer_write(&rb, rx_buff);
+    uint8_t rx_buff[RX_FIFO_SIZE];
+    size_t size;
+    uint32_t start = trace_now();
+
+    stats.rx_irqs++;
+    // Drain the whole FIFO, bytes may keep arriving while we copy
+    while ((size = MSS_UART_get_rx(this_uart, rx_buff, sizeof(rx_buff))) > 0) {
+        stats.rx_bytes += size;
+        stats.rx_dropped += size - ring_buffer_write_n(&rb, rx_buff, size);
+    }
+    uint8_t status = MSS_UART_get_rx_status(this_uart);
+    if (status & MSS_UART_OVERUN_ERROR) {
+        stats.rx_overruns++;
+    }
+    if (status & (MSS_UART_FRAMING_ERROR | MSS_UART_PARITY_ERROR)) {
+        stats.rx_errors++;
+    }
+    trace_record(TRACE_UART_RX_ISR, start);
+}
+
+static void uart_tx_handler(mss_uart_instance_t *this_uart) {
+    uint32_t head = tx_head;
+    uint32_t tail = tx_tail;
+    if (head == tail) {
+        MSS_UART_disable_irq(this_uart, MSS_UART_TBE_IRQ);
+        return;
     }
+    // Send up to the end of the buffer, the rest goes on the next interrupt
+    uint32_t span = ((head > tail) ? head : UART_TX_BUFFER_SIZE) - tail;
+    size_t sent = MSS_UART_fill_tx_fifo(this_uart, &tx_buffer[tail], span);
+    tx_tail = (tail + sent) & TX_BUFFER_MASK;
 }
 
 void uart_init() {
-    ring_buffer_init(&rb, data_buffer, RING_BUFFER_SIZE);
-    MSS_UART_init(&g_mss_uart0, BAUD_RATE,
+    uart_configure(UART_DEFAULT_BAUD);
+}
+
+static void uart_configure(uint32_t baud) {
+    tx_head = 0;
+    tx_tail = 0;
+    baud_rate = baud;
+    ring_buffer_init(&rb, data_buffer, UART_RX_BUFFER_SIZE);
+    MSS_UART_init(&g_mss_uart0, baud,
                   MSS_UART_DATA_8_BITS | MSS_UART_NO_PARITY);
-    MSS_UART_set_rx_handler(&g_mss_uart0, uart_rx_handler,
-                            MSS_UART_FIFO_SINGLE_BYTE);
+    MSS_UART_set_rx_handler(&g_mss_uart0, uart_rx_handler, RX_TRIGGER_LEVEL);
+    // Tail bytes below the trigger level are picked up on receiver timeout
+    MSS_UART_enable_rx_timeout(&g_mss_uart0, RX_TIMEOUT);
+    MSS_UART_set_rx_timeout_handler(&g_mss_uart0, uart_rx_handler);
     MSS_UART_enable_irq(&g_mss_uart0, MSS_UART_RBF_IRQ);
+    // Fires once with nothing to send and switches itself off
+    MSS_UART_set_tx_handler(&g_mss_uart0, uart_tx_handler);
+}
+
+// The MMUART divides PCLK by 16 x (integer + n/64). The driver only uses
+// the fractional part for integer divisors above 1.
+bool uart_baud_supported(uint32_t baud) {
+    if (baud == 0 || baud > g_FrequencyPCLK0 / 16) {
+        return false;
+    }
+    uint32_t div_64 = (4u * g_FrequencyPCLK0 + baud / 2) / baud;
+    if (div_64 < 128) {
+        div_64 &= ~63u;
+    }
+    uint32_t actual = (4u * g_FrequencyPCLK0) / div_64;
+    uint32_t diff = (actual > baud) ? actual - baud : baud - actual;
+    return diff <= (uint64_t)baud * BAUD_MAX_ERROR / 1000;
+}
+
+// Drops whatever is still in the receive path, the caller makes sure the
+// other side is not sending while the rate changes
+bool uart_set_baud(uint32_t baud) {
+    if (!uart_baud_supported(baud)) {
+        return false;
+    }
+    while (!uart_tx_done()) {
+    }
+    NVIC_DisableIRQ(UART0_IRQn);
+    uart_configure(baud);
+    return true;
+}
+
+uint32_t uart_get_baud() {
+    return baud_rate;
 }
 
 void uart_deinit() {
+    // Let the last response leave before the UART is reset
+    while (!uart_tx_done()) {
+    }
     g_mss_uart0.hw_reg = UART0;
     g_mss_uart0.irqn = UART0_IRQn;
     /* reset UART0 */
@@ -37,19 +135,38 @@ void uart_deinit() {
 }
 
 void uart_write(const uint8_t *data, uint32_t len) {
-    MSS_UART_polled_tx(&g_mss_uart0, data, len);
-}
-
-uint8_t uart_read(uint8_t *data, uint32_t len) {
-    if(len == 0) {
-        return 0;
-    }
-    for(size_t i = 0; i < len; i++) {
-        if(!ring_buffer_read(&rb, &data[i])) {
-            return i;
+    while (len > 0) {
+        uint32_t head = tx_head;
+        uint32_t free = (tx_tail - head - 1) & TX_BUFFER_MASK;
+        if (free == 0) {
+            // Only blocks when more than a buffer's worth is queued
+            MSS_UART_enable_irq(&g_mss_uart0, MSS_UART_TBE_IRQ);
+            while (((tx_tail - tx_head - 1) & TX_BUFFER_MASK) == 0) {
+            }
+            continue;
         }
+        uint32_t chunk = UART_TX_BUFFER_SIZE - head;
+        if (chunk > free) {
+            chunk = free;
+        }
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(&tx_buffer[head], data, chunk);
+        tx_head = (head + chunk) & TX_BUFFER_MASK;
+        data += chunk;
+        len -= chunk;
     }
-    return len;
+    MSS_UART_enable_irq(&g_mss_uart0, MSS_UART_TBE_IRQ);
+}
+
+bool uart_tx_done() {
+    return (tx_head == tx_tail) &&
+           (MSS_UART_get_tx_status(&g_mss_uart0) & MSS_UART_TEMT);
+}
+
+uint32_t uart_read(uint8_t *data, uint32_t len) {
+    return ring_buffer_read_n(&rb, data, len);
 }
 
 uint8_t uart_receive_byte() {
@@ -61,3 +178,9 @@ uint8_t uart_receive_byte() {
 bool uart_data_available() {
     return !ring_buffer_empty(&rb);
 }
+
+void uart_get_stats(UartStats *out) {
+    NVIC_DisableIRQ(UART0_IRQn);
+    *out = stats;
+    NVIC_EnableIRQ(UART0_IRQn);
+}
@@ -102,6 +102,20 @@ static NVM32_TypeDef * const g_nvm32[] =
  * if eNVM write or No R/W protection is enabled
  */
 static uint8_t g_do_not_lock_page = OFF;
+
+/*******************************************************************************
+ * Progress of the page program started by NVM_write_page_start().
+ */
+#define PAGE_WRITE_IDLE                 0u
+#define PAGE_WRITE_PROGRAM              1u
+#define PAGE_WRITE_VERIFY               2u
+#define PAGE_WRITE_DONE                 3u
+
+static uint32_t g_page_write_phase = PAGE_WRITE_IDLE;
+static uint32_t g_page_write_block;
+static uint32_t g_page_write_offset;
+static uint32_t g_page_write_hw_status;
+static uint32_t g_page_write_nvm_config;
         
         
 /**************************************************************************/
@@ -460,6 +474,199 @@ NVM_unlock
     return status;
 }
 
+/**************************************************************************//**
+ * See mss_nvm.h for details of how to use this function.
+ */
+nvm_status_t
+NVM_write_page_start
+(
+    uint32_t start_addr,
+    const uint8_t * pidata,
+    uint32_t lock_page
+)
+{
+    nvm_status_t status;
+    uint32_t nvm_offset;
+    uint32_t device_version;
+
+    /* Check input parameters */
+    if((PAGE_WRITE_IDLE != g_page_write_phase) ||
+        (start_addr >= (NVM_BASE_ADDRESS + NVM_TOP_OFFSET)) ||
+        ((start_addr >= NVM_TOP_OFFSET) &&
+        (start_addr < NVM_BASE_ADDRESS)) ||
+        ((start_addr % BYTES_PER_PAGE) != 0u) ||
+        ((const uint8_t *)0 == pidata) ||
+        (lock_page > PARAM_LOCK_PAGE_FLAG))
+    {
+        return NVM_INVALID_PARAMETER;
+    }
+
+    g_do_not_lock_page = OFF;
+
+    /* SAR 57547: see NVM_write(). */
+    g_page_write_nvm_config = SYSREG->ENVM_CR;
+    SYSREG->ENVM_CR = (g_page_write_nvm_config & NVM_FREQRNG_MASK) | NVM_FREQRNG_MAX;
+
+    /*
+     * Only lock pages on devices that can unlock them again, see NVM_write()
+     * for the device specific exceptions.
+     */
+    device_version = SYSREG->DEVICE_VERSION;
+    if((0x0000F802u == device_version) || (0x0001F802u == device_version) ||
+       (0xF806u == (device_version & 0xFFFFu)) ||
+       (0xF807u == (device_version & 0xFFFFu)) ||
+       (0xF808u == (device_version & 0xFFFFu)))
+    {
+        lock_page = NVM_DO_NOT_LOCK_PAGE;
+    }
+
+    /* Ignore upper address bits to ignore remapping setting. */
+    nvm_offset = start_addr & NVM_OFFSET_SIGNIFICANT_BITS;
+
+    status = check_protection_reserved_nvm(nvm_offset, BYTES_PER_PAGE);
+    if(ON == g_do_not_lock_page)
+    {
+        lock_page = NVM_DO_NOT_LOCK_PAGE;
+    }
+
+    if(NVM_SUCCESS == status)
+    {
+        status = get_ctrl_access(nvm_offset, BYTES_PER_PAGE);
+    }
+
+    if(NVM_SUCCESS == status)
+    {
+        if(nvm_offset < NVM1_BOTTOM_OFFSET)
+        {
+            g_page_write_block = NVM_BLOCK_0;
+        }
+        else
+        {
+            g_page_write_block = NVM_BLOCK_1;
+            nvm_offset = nvm_offset - NVM1_BOTTOM_OFFSET;
+        }
+        g_page_write_offset = nvm_offset;
+        g_page_write_hw_status = 0u;
+
+        if(g_nvm[g_page_write_block]->STATUS & MSS_NVM_WR_DENIED)
+        {
+            /* Clear the access denied flag */
+            g_nvm[g_page_write_block]->CLRHINT |= ACCESS_DENIED_FLAG_CLEAR;
+        }
+
+        /* Whole page: fill_wd_buffer() does not read back the eNVM content. */
+        fill_wd_buffer(pidata, BYTES_PER_PAGE, g_page_write_block, nvm_offset);
+
+        /* Set requested locking option. */
+        g_nvm[g_page_write_block]->PAGE_LOCK = lock_page;
+
+        /* Issue program command and return without waiting for completion. */
+        g_nvm[g_page_write_block]->CMD = PROG_ADS | (nvm_offset & PAGE_ADDR_MASK);
+        g_page_write_phase = PAGE_WRITE_PROGRAM;
+    }
+    else
+    {
+        g_do_not_lock_page = OFF;
+        SYSREG->ENVM_CR = g_page_write_nvm_config;
+    }
+
+    return status;
+}
+
+/**************************************************************************//**
+ * See mss_nvm.h for details of how to use this function.
+ */
+uint32_t
+NVM_write_page_poll
+(
+    void
+)
+{
+    uint32_t ctrl_status;
+    uint32_t inc;
+
+    if((PAGE_WRITE_PROGRAM != g_page_write_phase) &&
+       (PAGE_WRITE_VERIFY != g_page_write_phase))
+    {
+        return 0u;
+    }
+
+    /*
+     * The ready bit must be read set twice before the other status bits can
+     * be trusted. See SmartFusion2 errata and wait_nvm_ready().
+     */
+    for(inc = 0u; inc < 2u; ++inc)
+    {
+        ctrl_status = g_nvm[g_page_write_block]->STATUS;
+        if(0u == (ctrl_status & MSS_NVM_BUSY_B))
+        {
+            return 1u;
+        }
+    }
+
+    if(PAGE_WRITE_PROGRAM == g_page_write_phase)
+    {
+        if(ctrl_status & WRITE_ERROR_MASK)
+        {
+            g_page_write_hw_status = ctrl_status;
+            g_page_write_phase = PAGE_WRITE_DONE;
+        }
+        else
+        {
+            /* Perform a verify. */
+            g_nvm[g_page_write_block]->CMD = VERIFY_ADS | (g_page_write_offset & PAGE_ADDR_MASK);
+            g_page_write_phase = PAGE_WRITE_VERIFY;
+        }
+    }
+    else
+    {
+        g_page_write_hw_status = ctrl_status;
+        g_page_write_phase = PAGE_WRITE_DONE;
+    }
+
+    return (PAGE_WRITE_DONE == g_page_write_phase) ? 0u : 1u;
+}
+
+/**************************************************************************//**
+ * See mss_nvm.h for details of how to use this function.
+ */
+nvm_status_t
+NVM_write_page_complete
+(
+    void
+)
+{
+    nvm_status_t status = NVM_SUCCESS;
+    uint32_t errors_and_warnings;
+
+    if(PAGE_WRITE_IDLE == g_page_write_phase)
+    {
+        return NVM_INVALID_PARAMETER;
+    }
+
+    while(NVM_write_page_poll())
+    {
+        ;
+    }
+
+    errors_and_warnings = g_page_write_hw_status & (WRITE_ERROR_MASK | MSS_NVM_WRCNT_OVER);
+    if(errors_and_warnings)
+    {
+        status = get_error_code(g_page_write_hw_status);
+    }
+
+    /* Release eNVM controllers so that other masters can gain access to it. */
+    release_ctrl_access();
+
+    g_do_not_lock_page = OFF;
+
+    /* Restore back to original value. */
+    SYSREG->ENVM_CR = g_page_write_nvm_config;
+    g_page_write_phase = PAGE_WRITE_IDLE;
+
+    return status;
+}
+
 /**************************************************************************/
 /* Private function definitions                                            */
 /**************************************************************************/
@@ -198,6 +198,86 @@ NVM_write
     uint32_t lock_page
 );
 
+/***************************************************************************//**
+  The NVM_write_page_start() function starts programming one whole, page
+  aligned eNVM page and returns without waiting for the program to complete.
+  The data is copied into the eNVM controller write buffer before the function
+  returns, so the pidata buffer can be reused straight away.
+  Progress must then be driven by calling NVM_write_page_poll() until it
+  returns 0, followed by a single call to NVM_write_page_complete(). Only one
+  page program can be in progress at a time and NVM_write() must not be called
+  until it has been completed.
+  Note: The Cortex-M3 must not fetch from the eNVM array being programmed while
+        the program is in progress or it will be stalled until completion.
+
+  @param start_addr
+    The start_addr parameter is the start address of the eNVM page to program.
+    It must be aligned on a 128 bytes page boundary.
+
+  @param pidata
+    The pidata parameter points to the 128 bytes of data to program.
+
+  @param lock_page
+    The lock_page parameter specifies whether the page must be locked once
+    programmed. Allowed values are NVM_DO_NOT_LOCK_PAGE and NVM_LOCK_PAGE.
+
+  @return
+    This function returns NVM_SUCCESS if the program was started. It returns
+    NVM_INVALID_PARAMETER if the address is not page aligned or another page
+    program is still in progress, and NVM_PROTECTION_ERROR or
+    NVM_IN_USE_BY_OTHER_MASTER if eNVM access could not be obtained.
+
+  Example:
+  @code
+    status = NVM_write_page_start(page_addr, page, NVM_DO_NOT_LOCK_PAGE);
+    if(NVM_SUCCESS == status)
+    {
+        while(NVM_write_page_poll())
+        {
+            do_other_work();
+        }
+        status = NVM_write_page_complete();
+    }
+  @endcode
+ */
+nvm_status_t
+NVM_write_page_start
+(
+    uint32_t start_addr,
+    const uint8_t * pidata,
+    uint32_t lock_page
+);
+
+/***************************************************************************//**
+  The NVM_write_page_poll() function advances the page program started by
+  NVM_write_page_start(). It issues the verify operation once programming is
+  done. This function does not block.
+
+  @return
+    This function returns a non-zero value while the page program or verify
+    is still in progress and 0 once NVM_write_page_complete() can be called.
+ */
+uint32_t
+NVM_write_page_poll
+(
+    void
+);
+
+/***************************************************************************//**
+  The NVM_write_page_complete() function finishes the page program started by
+  NVM_write_page_start(), releases the eNVM controller and returns the outcome
+  of the program and verify operations. It blocks if the page program is still
+  in progress.
+
+  @return
+    This function returns the same status codes as NVM_write().
+ */
+nvm_status_t
+NVM_write_page_complete
+(
+    void
+);
+
 /***************************************************************************//**
   The NVM_unlock() function is used to unlock the eNVM pages for a specified
   range of eNVM addresses in preparation for writing data into the unlocked
@@ -1,25 +1,81 @@
 import os
+import hashlib
+import json
+import struct
 import time
+import zlib
 from argparse import ArgumentParser
-from ctypes import Structure, c_uint8
+from contextlib import contextmanager
+from dataclasses import dataclass, field
+from ctypes import Structure, c_uint8, c_uint16, c_uint32
 from enum import IntEnum
 from logging import basicConfig, getLogger
+from typing import Optional
 
-from serial import Serial
+from serial import Serial, SerialException
 from tqdm import tqdm
 
+from tools.lz import compress
+
 MAX_DATA_LEN = 255
+MAX_FRAME_DATA_LEN = 1024
+FRAME_V1 = 1
+FRAME_V2 = 2
 FW_ADDR_LEN = 4
+FW_SEQ_LEN = 1
+FW_FLAG_COMMIT = 0x01
+FW_FLAG_DELTA = 0x02
+FW_FLAG_COMPRESSED = 0x04
+FLASH_PAGE_SIZE = 128
+IMAGE_HEADER_SIZE = 0x200 # See tools/image-header.py
+IMAGE_HEADER_VERSION = 2 # IMAGE_HEADER_VERSION in bootloader/inc/image.h
+IMAGE_LOAD_ADDR_OFFSET = 52 # load_addr in the header
+APP_SLOT_ADDRS = (0x8000, 0x23C00) # APP_SLOT_ADDR() in bootloader/inc/bootloader.h
+FW_SLOT_LEN = 5 # Slot index and address in FW_LEN_REQ and SELECT_SLOT
+SLOT_OTHER = 0xFF # SELECT_SLOT: the slot that is not running
+DEFAULT_WINDOW = 4
+# Tried from the top by --max-baud, all within 0.25% on the 100 MHz PCLK
+BAUD_RATES = [3000000, 2000000, 1500000, 1000000]
+BAUD_CONFIRM_TIMEOUT = 0.5 # Target goes back to the old rate after this
 SYNC_BYTES = b'\xDE\xAD\xBE\xEF'
+WAKE_INTERVAL = 0.002 # Well inside the target's 10 ms listen window after reset
+APP_HANDOVER_TIME = 0.1 # App reset to bootloader waiting for CMD_UPDATE_REQ
+# TraceEvent order in bootloader/inc/trace.h
+TRACE_EVENTS = ["uart_rx_isr", "comms_update", "fw_packet", "nvm_page", "sha256", "inflate", "image_check"]
+TRACE_OP_SUMMARY = 0
+TRACE_OP_RECORDS = 1
+TRACE_OP_RESET = 2
+# Counters of CMD_GET_STATS, FW_UPDATE_DONE and NACK, see bl_put_stats()
+STATS_FIELDS = ["rx_bytes", "rx_irqs", "rx_dropped", "rx_overruns", "rx_errors",
+                "checksum_errors", "retx_sent", "retx_received", "packets_dropped",
+                "pages_programmed", "nvm_errors", "nvm_program_max_us", "verify_us"]
 
 logger = getLogger(__name__)
 
+
+def _crc8_table() -> bytes:
+    # Same table as crc8_table in bootloader/src/crc.c (poly 0x07)
+    table = []
+    for byte in range(256):
+        crc = byte
+        for _ in range(8):
+            if crc & 0x80:
+                crc = ((crc << 1) ^ 0x07) & 0xFF
+            else:
+                crc = (crc << 1) & 0xFF
+        table.append(crc)
+    return bytes(table)
+
+
+CRC8_TABLE = _crc8_table()
+
+
 class Packet(Structure):
     _fields_ = [
         ("cmd", c_uint8),
-        ("len", c_uint8),
-        ("data", c_uint8 * MAX_DATA_LEN),
-        ("checksum", c_uint8),
+        ("len", c_uint16),
+        ("data", c_uint8 * MAX_FRAME_DATA_LEN),
+        ("checksum", c_uint32), # crc8 for v1 frames, CRC-32 for v2
     ]
 
     def __str__(self):
@@ -43,36 +99,243 @@ class ProtocolCmd(IntEnum):
     UPDATE_REQ      = 0x03 # Request firmware update
     FW_LEN_REQ      = 0x04 # Request firmware length
     FW_LEN_RESP     = 0x05 # Response firmware length
+    FRAME_FORMAT    = 0x06 # Negotiate frame format
+    SET_BAUD        = 0x07 # Switch the UART rate, confirmed at the new rate
     RESET           = 0x14 # Reset the device
     READ_MEM        = 0x15 # Read memory
     WRITE_MEM       = 0x16 # Write memory
     WRITE_DATA_RDY  = 0x17 # Ready for data
     FW_UPDATE_DONE  = 0x18 # Firmware update done
+    WRITE_MEM_SEQ   = 0x19 # Write memory, windowed transfer
+    WINDOW_ACK      = 0x1A # Cumulative ACK of windowed writes
+    WINDOW_NACK     = 0x1B # Missing sequence in windowed writes
+    FW_COMMIT       = 0x1C # Expected image digest, ends the transfer
+    READ_HASH       = 0x1D # CRC-32 of each flash page in a range
+    FILL_MEM        = 0x1E # Set whole pages to one byte value
+    FILL_MEM_SEQ    = 0x1F # Set whole pages, windowed transfer
+    READ_TRACE      = 0x20 # Cycle counts of the hot paths
+    GET_STATS       = 0x21 # Error and throughput counters of the session
+    SELECT_SLOT     = 0x22 # Boot the other slot from now on
     RETX            = 0x90 # Retransmit last packet
     ACK             = 0x91 # Acknowledge
     NACK            = 0x92 # Not Acknowledge
 
+@dataclass
+class Fill:
+    """Chunk payload for `pages` whole flash pages of one byte value. Its
+    length is the number of image bytes it stands for."""
+    pages: int
+    pattern: int
+
+    def __len__(self):
+        return self.pages * FLASH_PAGE_SIZE
+
+    def to_bytes(self) -> bytes:
+        return self.pages.to_bytes(2, byteorder='big') + bytes([self.pattern])
+
+# Upper edges of the RTT histogram buckets in ms, the last one is open
+RTT_BUCKETS_MS = [0.5, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1000]
+
+@dataclass
+class TransferStats:
+    """What --bench reports: wall time per phase, the time from sending a
+    data packet to its ACK and how often something had to be sent again."""
+    phases: dict = field(default_factory=dict)
+    rtts: list = field(default_factory=list)
+    retx: int = 0            # RETX from the target, packet sent again
+    window_timeouts: int = 0 # No ACK in time, window sent again
+    window_nacks: int = 0    # Target reported a gap
+    chunks_resent: int = 0   # Data packets that went out more than once
+
+    @contextmanager
+    def phase(self, name: str):
+        t0 = time.perf_counter()
+        try:
+            yield
+        finally:
+            self.phases[name] = self.phases.get(name, 0) + time.perf_counter() - t0
+
+    def rtt_summary(self) -> dict:
+        rtts = sorted(self.rtts)
+        if not rtts:
+            return {"count": 0}
+        ms = [r * 1000 for r in rtts]
+        histogram = {}
+        for r in ms:
+            edge = next((e for e in RTT_BUCKETS_MS if r <= e), None)
+            key = f"<={edge}" if edge is not None else f">{RTT_BUCKETS_MS[-1]}"
+            histogram[key] = histogram.get(key, 0) + 1
+        pick = lambda q: ms[min(len(ms) - 1, int(q * len(ms)))]
+        return {"count": len(ms), "min": ms[0], "p50": pick(0.5), "p90": pick(0.9),
+                "p99": pick(0.99), "max": ms[-1], "histogram_ms": histogram}
+
+def target_stats(packet, offset: int = 0) -> Optional[dict]:
+    """Session counters at `offset` in a packet from the target, None if an
+    older bootloader did not send them."""
+    data = bytes(packet.data[offset:packet.len])
+    if len(data) < 4 * len(STATS_FIELDS):
+        return None
+    return {name: int.from_bytes(data[4 * i:4 * i + 4], byteorder='big') for i, name in enumerate(STATS_FIELDS)}
+
+def log_target_stats(stats: Optional[dict]):
+    if stats is not None:
+        logger.info("Target: %s", " ".join(f"{k}={v}" for k, v in stats.items()))
+
+def slot_from_bytes(data: bytes) -> tuple[int, int]:
+    return data[0], int.from_bytes(data[1:FW_SLOT_LEN], byteorder='big')
+
+def image_load_addr(image: bytes) -> int:
+    """Slot address an image from tools/image-header.py was linked for."""
+    if len(image) < IMAGE_HEADER_SIZE:
+        raise BootloaderException("Image is shorter than its header")
+    version = struct.unpack_from("<I", image, 4)[0]
+    if version != IMAGE_HEADER_VERSION:
+        raise BootloaderException(f"Image header version {version}, expected {IMAGE_HEADER_VERSION}")
+    return struct.unpack_from("<I", image, IMAGE_LOAD_ADDR_OFFSET)[0]
+
+def trace_report(core_hz: int, totals: list[dict], records: list[tuple]) -> dict:
+    """Per event time in microseconds. Count, mean and max cover the whole
+    transfer, the percentiles only the records still in the target's ring."""
+    us = lambda cycles: cycles * 1e6 / core_hz
+    report = {}
+    for i, name in enumerate(TRACE_EVENTS):
+        t = totals[i]
+        if not t["count"]:
+            continue
+        kept = sorted(us(cycles) for event, _, cycles in records if event == i)
+        pick = lambda q: kept[min(len(kept) - 1, int(q * len(kept)))] if kept else None
+        report[name] = {"count": t["count"], "mean_us": us(t["total"]) / t["count"],
+                        "max_us": us(t["max"]), "total_ms": us(t["total"]) / 1000,
+                        "p50_us": pick(0.5), "p99_us": pick(0.99)}
+    return report
+
 class BootloaderFlasher:
     def __init__(self, serial_port: str, baud_rate: int):
         self.serial_port = serial_port
         self.serial = Serial(serial_port, baud_rate, timeout=0.1)
+        self.frame_version = FRAME_V1
+        self.max_data_len = MAX_DATA_LEN
+        self.stats = TransferStats()
         logger.info(f"Opened serial port {serial_port} at {baud_rate} baud")
         self.serial.reset_input_buffer()
-        self.serial.set_output_flow_control(False)
-        self.serial.set_input_flow_control(False)
+        # On a pty (the host sim) these become tcflow(TCOOFF/TCIOFF), which
+        # suspends the line instead of turning flow control off, and the
+        # first write blocks forever.
+        if not os.path.realpath(serial_port).startswith("/dev/pts/"):
+            self.serial.set_output_flow_control(False)
+            self.serial.set_input_flow_control(False)
+
+    def wake(self, seconds: float):
+        """Keep the line busy with zero bytes, the same the target sees from a
+        break, so a target reset meanwhile stays in the bootloader instead of
+        starting its app. It waits BL_SYNC_TIMEOUT_MS for the sync after that,
+        so keep this shorter."""
+        logger.info("Reset the target now, waking it for %.1f s", seconds)
+        end = time.perf_counter() + seconds
+        while time.perf_counter() < end:
+            self.serial.write(b'\x00')
+            time.sleep(WAKE_INTERVAL)
+
+    def request_from_app(self):
+        """The app (app/src/bootloader-request.c) takes the sync as a request
+        and resets into the bootloader, which then skips its sync."""
+        self.send_sync()
+        time.sleep(APP_HANDOVER_TIME)
+        self.serial.reset_input_buffer()
+        logger.info("Asked the app to hand over to the bootloader")
 
     def send_sync(self):
         self.serial.write(SYNC_BYTES)
         logger.debug("Sent sync")
 
+    def negotiate_frame(self, version=FRAME_V2, max_len=MAX_FRAME_DATA_LEN):
+        """Ask for the v2 frame format right after sync. Targets that do not
+        know CMD_FRAME_FORMAT only ACK it, then we stay on v1 frames."""
+        if version == FRAME_V1:
+            return FRAME_V1
+        self.send_request(ProtocolCmd.FRAME_FORMAT,
+                          bytes([version]) + max_len.to_bytes(2, byteorder='big'))
+        try:
+            resp = self.receive_packet(0.5)
+        except TimeoutError:
+            logger.info("Target does not negotiate frames, using v1")
+            return FRAME_V1
+        if resp.cmd != ProtocolCmd.FRAME_FORMAT or resp.len < 3:
+            raise BootloaderException(f"Unexpected frame format reply {resp}")
+        self.frame_version = resp.data[0]
+        if self.frame_version == FRAME_V2:
+            self.max_data_len = int.from_bytes(bytes(resp.data[1:3]), byteorder='big')
+        logger.info(f"Using v{self.frame_version} frames, {self.max_data_len} byte payloads")
+        return self.frame_version
+
+    def switch_baud(self, baud: int) -> bool:
+        """Move both sides to `baud`. The target answers at the old rate,
+        then the request is repeated with a test pattern at the new rate and
+        has to come back intact. Without that the target returns to the old
+        rate on its own after BAUD_CONFIRM_TIMEOUT."""
+        old = self.serial.baudrate
+        self.send_request(ProtocolCmd.SET_BAUD, baud.to_bytes(4, byteorder='big'))
+        try:
+            resp = self.receive_packet(BAUD_CONFIRM_TIMEOUT)
+        except TimeoutError:
+            logger.info("Target does not switch baud rates")
+            return False
+        if resp.cmd != ProtocolCmd.SET_BAUD or resp.len < 4 or \
+                int.from_bytes(bytes(resp.data[:4]), byteorder='big') != baud:
+            logger.info("Target cannot run at %d baud", baud)
+            return False
+        try:
+            self.serial.baudrate = baud
+        except (ValueError, SerialException):
+            logger.info("Adapter cannot run at %d baud", baud)
+            time.sleep(BAUD_CONFIRM_TIMEOUT)
+            return False
+        self.serial.reset_input_buffer()
+        test = baud.to_bytes(4, byteorder='big') + bytes(i & 0xFF for i in range(self.max_data_len - 4))
+        try:
+            self.send_request(ProtocolCmd.SET_BAUD, test)
+        except (TimeoutError, ValueError, BootloaderException):
+            logger.warning("No confirm at %d baud, back to %d", baud, old)
+            self.serial.baudrate = old
+            time.sleep(BAUD_CONFIRM_TIMEOUT)
+            self.serial.reset_input_buffer()
+            return False
+        # The target got the confirm and keeps the new rate from here on
+        try:
+            echo = self.receive_packet(BAUD_CONFIRM_TIMEOUT)
+            ok = echo.checksum == self._checksum(echo) and bytes(echo.data[:echo.len]) == test
+        except (TimeoutError, ValueError):
+            ok = False
+        if not ok:
+            logger.warning("Corrupted echo at %d baud, going back to %d", baud, old)
+            self.switch_baud(old)
+            return False
+        logger.info("Switched to %d baud", baud)
+        return True
+
+    def pick_baud(self, max_baud: int) -> int:
+        """Fastest rate from BAUD_RATES up to `max_baud` that works."""
+        for baud in BAUD_RATES:
+            if self.serial.baudrate < baud <= max_baud and self.switch_baud(baud):
+                break
+        return self.serial.baudrate
+
     def send_packet(self, packet: Packet):
         packet.checksum = self._checksum(packet)
-        data = bytes([packet.cmd, packet.len, *packet.data[:packet.len], packet.checksum])
-        self.serial.write(data)
+        if self.frame_version == FRAME_V2:
+            frame = self._frame_header(packet) + bytes(packet.data[:packet.len])
+            frame += packet.checksum.to_bytes(4, byteorder='big')
+        else:
+            frame = bytes([packet.cmd, packet.len, *packet.data[:packet.len], packet.checksum])
+        self.serial.write(frame)
 
-    def send_fw_data(self, addr: int, data: bytes):
-        if len(data) > MAX_DATA_LEN - 4:
-            raise ValueError(f"Data length {len(data)} exceeds maximum {MAX_DATA_LEN - 4}")
+    def send_fw_data(self, addr: int, data):
+        if isinstance(data, Fill):
+            cmd, data = ProtocolCmd.FILL_MEM, data.to_bytes()
+        else:
+            cmd = ProtocolCmd.WRITE_MEM
+        if len(data) > self.max_data_len - FW_ADDR_LEN:
+            raise ValueError(f"Data length {len(data)} exceeds maximum {self.max_data_len - FW_ADDR_LEN}")
         try:
             packet = self.receive_packet()
         except TimeoutError:
@@ -80,13 +343,180 @@ class BootloaderFlasher:
         if packet.cmd != ProtocolCmd.WRITE_DATA_RDY:
             raise BootloaderException("Bootloader not ready for data")
         packet = Packet()
-        packet.cmd = ProtocolCmd.WRITE_MEM
+        packet.cmd = cmd
         packet.len = len(data) + FW_ADDR_LEN
         packet.data[:FW_ADDR_LEN] = addr.to_bytes(FW_ADDR_LEN, byteorder='big')
         packet.data[FW_ADDR_LEN:packet.len] = data
         logger.debug("Writing %d bytes to 0x%08X", len(data), addr)
+        t0 = time.perf_counter()
         self.send_packet(packet)
         self.wait_ack(packet)
+        self.stats.rtts.append(time.perf_counter() - t0)
+
+    def send_fw_windowed(self, addr: int, image: bytes, window: int, progress=None, timeout=1):
+        """Stream the image keeping up to `window` WRITE_MEM_SEQ packets in
+        flight. The target ACKs cumulatively and NACKs the first missing
+        sequence; on NACK or timeout we go back to the oldest unacked chunk."""
+        chunk_size = self.max_data_len - FW_SEQ_LEN - FW_ADDR_LEN
+        chunks = [(addr + off, image[off:off + chunk_size])
+                  for off in range(0, len(image), chunk_size)]
+        self.send_chunks_windowed(chunks, window, progress, timeout)
+
+    def send_chunks_windowed(self, chunks, window: int, progress=None, timeout=1):
+        """Windowed transfer of a list of (addr, data) chunks, see
+        send_fw_windowed()."""
+        base = 0
+        next_idx = 0
+        sent = 0  # Chunks below this went out at least once
+        sent_at = [0.0] * len(chunks)
+        while base < len(chunks):
+            while next_idx < len(chunks) and next_idx - base < window:
+                chunk_addr, data = chunks[next_idx]
+                sent_at[next_idx] = time.perf_counter()
+                self._send_seq_chunk(next_idx & 0xFF, chunk_addr, data)
+                if next_idx < sent:
+                    self.stats.chunks_resent += 1
+                next_idx += 1
+                sent = max(sent, next_idx)
+            try:
+                resp = self.receive_packet(timeout)
+            except TimeoutError:
+                logger.warning("Timeout in window at chunk %d, resending", base)
+                self.stats.window_timeouts += 1
+                next_idx = base
+                continue
+            if resp.checksum != self._checksum(resp):
+                logger.debug("Dropping corrupted packet %s", resp)
+                continue
+            if resp.cmd == ProtocolCmd.NACK:
+                log_target_stats(target_stats(resp))
+                raise BootloaderException("NACK received")
+            distance = (resp.data[0] - base) & 0xFF
+            if distance >= next_idx - base:
+                # Stale ACK/NACK for a sequence outside the window
+                continue
+            if resp.cmd == ProtocolCmd.WINDOW_ACK:
+                acked = base + distance + 1
+                now = time.perf_counter()
+                self.stats.rtts += [now - t for t in sent_at[base:acked]]
+                if progress is not None:
+                    progress(sum(len(d) for _, d in chunks[base:acked]))
+                base = acked
+            elif resp.cmd == ProtocolCmd.WINDOW_NACK:
+                logger.warning("Target missed chunk %d, resending", base + distance)
+                self.stats.window_nacks += 1
+                next_idx = base + distance
+
+    def read_page_hashes(self, addr: int, count: int) -> list[int]:
+        """CRC-32 of `count` flash pages from `addr`, as zlib.crc32 gives."""
+        hashes = []
+        batch = self.max_data_len // 4
+        while len(hashes) < count:
+            n = min(batch, count - len(hashes))
+            page_addr = addr + len(hashes) * FLASH_PAGE_SIZE
+            self.send_request(ProtocolCmd.READ_HASH,
+                              page_addr.to_bytes(FW_ADDR_LEN, byteorder='big') + n.to_bytes(2, byteorder='big'))
+            resp = self.receive_packet()
+            if resp.cmd != ProtocolCmd.READ_HASH or resp.len != n * 4:
+                raise BootloaderException(f"Bad READ_HASH reply {resp}")
+            data = bytes(resp.data[:resp.len])
+            hashes += [int.from_bytes(data[i:i + 4], byteorder='big') for i in range(0, len(data), 4)]
+        return hashes
+
+    def read_stats(self) -> Optional[dict]:
+        """Session counters of the target, see STATS_FIELDS."""
+        self.send_request(ProtocolCmd.GET_STATS)
+        resp = self.receive_packet()
+        if resp.cmd != ProtocolCmd.GET_STATS:
+            raise BootloaderException(f"Bad GET_STATS reply {resp}")
+        return target_stats(resp)
+
+    def read_trace(self) -> dict:
+        """Fetch the target's cycle count totals and the ring of recent
+        events, see bootloader/inc/trace.h."""
+        self.send_request(ProtocolCmd.READ_TRACE, bytes([TRACE_OP_SUMMARY]))
+        resp = self.receive_packet()
+        data = bytes(resp.data[:resp.len])
+        if resp.cmd != ProtocolCmd.READ_TRACE or len(data) != 8 + 16 * len(TRACE_EVENTS):
+            raise BootloaderException(f"Bad READ_TRACE reply {resp}")
+        words = [int.from_bytes(data[i:i + 4], byteorder='big') for i in range(0, len(data), 4)]
+        core_hz, written = words[0], words[1]
+        totals = [{"count": words[i], "max": words[i + 1], "total": (words[i + 2] << 32) | words[i + 3]}
+                  for i in range(2, len(words), 4)]
+        records = []
+        # The ring size is a build option on the target, read until it runs out
+        while len(records) < written:
+            self.send_request(ProtocolCmd.READ_TRACE,
+                              bytes([TRACE_OP_RECORDS]) + len(records).to_bytes(2, byteorder='big'))
+            resp = self.receive_packet()
+            if resp.cmd != ProtocolCmd.READ_TRACE or resp.len == 0 or resp.len % 9:
+                break
+            data = bytes(resp.data[:resp.len])
+            records += [(data[i], int.from_bytes(data[i + 1:i + 5], byteorder='big'),
+                         int.from_bytes(data[i + 5:i + 9], byteorder='big')) for i in range(0, len(data), 9)]
+        logger.info("Read %d trace records, %d written", len(records), written)
+        return {"core_hz": core_hz, "written": written,
+                "events": trace_report(core_hz, totals, records)}
+
+    def delta_chunks(self, addr: int, image: bytes) -> list[tuple[int, bytes]]:
+        """Chunks covering only the pages of `image` that differ from the
+        flash. Runs of changed pages are packed into as few packets as fit."""
+        pages = (len(image) + FLASH_PAGE_SIZE - 1) // FLASH_PAGE_SIZE
+        current = self.read_page_hashes(addr, pages)
+        pages_per_chunk = max(1, (self.max_data_len - FW_SEQ_LEN - FW_ADDR_LEN) // FLASH_PAGE_SIZE)
+        chunks = []
+        run = None
+        for page in range(pages):
+            data = image[page * FLASH_PAGE_SIZE:(page + 1) * FLASH_PAGE_SIZE]
+            # A short last page reads back erased after the image
+            padded = data + bytes([0xff] * (FLASH_PAGE_SIZE - len(data)))
+            if zlib.crc32(padded) == current[page]:
+                run = None
+                continue
+            if run is not None and len(run[1]) < pages_per_chunk * FLASH_PAGE_SIZE:
+                run[1] += data
+            else:
+                run = [addr + page * FLASH_PAGE_SIZE, bytearray(data)]
+                chunks.append(run)
+        logger.info("Delta: %d of %d pages changed", sum(len(d) for _, d in chunks) // FLASH_PAGE_SIZE, pages)
+        return [(a, bytes(d)) for a, d in chunks]
+
+    def sparse_chunks(self, chunks):
+        """Replaces the whole pages of one byte value in page aligned
+        (addr, data) chunks by Fill runs. The rest is split to fit a packet."""
+        chunk_size = self.max_data_len - FW_SEQ_LEN - FW_ADDR_LEN
+        out = []
+        for addr, data in chunks:
+            start = 0
+            for off in range(0, len(data), FLASH_PAGE_SIZE):
+                page = data[off:off + FLASH_PAGE_SIZE]
+                if len(page) < FLASH_PAGE_SIZE or page.count(page[0]) != FLASH_PAGE_SIZE:
+                    continue
+                out += [(addr + o, data[o:min(o + chunk_size, off)]) for o in range(start, off, chunk_size)]
+                start = off + FLASH_PAGE_SIZE
+                last = out[-1] if out else None
+                if (last is not None and isinstance(last[1], Fill) and last[1].pattern == page[0]
+                        and last[0] + len(last[1]) == addr + off and last[1].pages < 0xFFFF):
+                    last[1].pages += 1
+                else:
+                    out.append((addr + off, Fill(1, page[0])))
+            out += [(addr + o, data[o:min(o + chunk_size, len(data))]) for o in range(start, len(data), chunk_size)]
+        filled = sum(len(d) for _, d in out if isinstance(d, Fill))
+        logger.info("Sparse: %d of %d bytes sent as fills", filled, sum(len(d) for _, d in out))
+        return out
+
+    def _send_seq_chunk(self, seq: int, addr: int, data):
+        packet = Packet()
+        packet.cmd = ProtocolCmd.WRITE_MEM_SEQ
+        if isinstance(data, Fill):
+            packet.cmd = ProtocolCmd.FILL_MEM_SEQ
+            data = data.to_bytes()
+        packet.len = FW_SEQ_LEN + FW_ADDR_LEN + len(data)
+        packet.data[0] = seq
+        packet.data[FW_SEQ_LEN:FW_SEQ_LEN + FW_ADDR_LEN] = addr.to_bytes(FW_ADDR_LEN, byteorder='big')
+        packet.data[FW_SEQ_LEN + FW_ADDR_LEN:packet.len] = data
+        logger.debug("Writing %d bytes to 0x%08X (seq %d)", len(data), addr, seq)
+        self.send_packet(packet)
 
     def send_request(self, cmd: ProtocolCmd, data=None):
         packet = Packet()
@@ -103,9 +533,11 @@ class BootloaderFlasher:
         resp = self.receive_packet(timeout)
         while resp.cmd == ProtocolCmd.RETX:
             logger.warning("Retransmitting packet %s", packet)
+            self.stats.retx += 1
             self.send_packet(packet)
             resp = self.receive_packet(timeout)
         if resp.cmd == ProtocolCmd.NACK:
+            log_target_stats(target_stats(resp))
             raise BootloaderException("NACK received")
         if resp.cmd != ProtocolCmd.ACK:
             raise ValueError(f"Expected ACK, got 0x{resp.cmd:X}")
@@ -118,18 +550,22 @@ class BootloaderFlasher:
     def receive_packet(self, timeout: float = 1) -> Packet:
         packet = Packet()
         t0 = time.time()
-        while self.serial.in_waiting < 2:
+        v2 = self.frame_version == FRAME_V2
+        header_len = 3 if v2 else 2
+        trailer_len = 4 if v2 else 1
+        while self.serial.in_waiting < header_len:
             if time.time() - t0 > timeout:
                 raise TimeoutError
-        packet.cmd = ProtocolCmd(self.serial.read(1)[0])
-        packet.len = self.serial.read(1)[0]
-        while self.serial.in_waiting < packet.len + 1:
+        header = self.serial.read(header_len)
+        packet.cmd = ProtocolCmd(header[0])
+        packet.len = int.from_bytes(header[1:], byteorder='big')
+        while self.serial.in_waiting < packet.len + trailer_len:
             if time.time() - t0 > timeout:
                 raise TimeoutError
         data = self.serial.read(packet.len)
         for i in range(packet.len):
             packet.data[i] = int.from_bytes(data[i:i+1], byteorder='little')
-        packet.checksum = self.serial.read(1)[0]
+        packet.checksum = int.from_bytes(self.serial.read(trailer_len), byteorder='big')
         logger.debug(f"Received packet: {packet}")
         return packet
 
@@ -138,22 +574,59 @@ class BootloaderFlasher:
         logger.info("Requested version")
         return response.data[0]
 
-    def request_update(self):
+    def request_update(self) -> tuple[int, int]:
+        """Returns the slot index and address the image has to go to. Targets
+        from before the slots only have the one at APP_SLOT_ADDRS[0]."""
         response = self._request_insist(ProtocolCmd.UPDATE_REQ)
         if response.cmd != ProtocolCmd.FW_LEN_REQ:
             raise ValueError(f"Expected FW_LEN_REQ, got {response.cmd}")
-        logger.info("Requested firmware update")
+        slot, addr = 0, APP_SLOT_ADDRS[0]
+        if response.len >= FW_SLOT_LEN:
+            slot, addr = slot_from_bytes(bytes(response.data[:FW_SLOT_LEN]))
+        logger.info(f"Requested firmware update into slot {slot} at 0x{addr:X}")
+        return slot, addr
+
+    def select_slot(self, slot: int = SLOT_OTHER) -> tuple[int, int]:
+        """Make the target start a slot from now on, by default the one not
+        running, e.g. to go back to the previous image. It starts it right away."""
+        self.send_request(ProtocolCmd.SELECT_SLOT, bytes([slot]))
+        response = self.receive_packet()
+        if response.cmd == ProtocolCmd.NACK:
+            log_target_stats(target_stats(response))
+            raise BootloaderException("Target has no valid image in that slot")
+        if response.cmd != ProtocolCmd.SELECT_SLOT or response.len < FW_SLOT_LEN:
+            raise ValueError(f"Expected SELECT_SLOT, got {response.cmd}")
+        return slot_from_bytes(bytes(response.data[:FW_SLOT_LEN]))
 
-    def send_fw_length(self, fw_len_bytes):
+    def send_fw_length(self, fw_len_bytes, window=0, flags=0):
+        """Send the firmware length. A non-zero window requests a windowed
+        transfer and returns the window size granted by the target."""
         data = fw_len_bytes.to_bytes(4, byteorder='big')
+        if window or flags:
+            data += bytes([window, flags])
         self.send_request(ProtocolCmd.FW_LEN_RESP, data)
         logger.info(f"Sent firmware length: {fw_len_bytes}")
+        if not window:
+            return 0
+        rdy = self.receive_packet()
+        if rdy.cmd != ProtocolCmd.WRITE_DATA_RDY or rdy.len < 1:
+            raise BootloaderException("Target does not support windowed transfer")
+        logger.info(f"Negotiated window of {rdy.data[0]} packets")
+        return rdy.data[0]
+
+    def send_commit(self, image: bytes):
+        """End a FW_FLAG_COMMIT transfer with the digest of the image after
+        its header. The target compares it with the one it hashed on the fly."""
+        digest = hashlib.sha256(image[IMAGE_HEADER_SIZE:]).digest()
+        self.send_request(ProtocolCmd.FW_COMMIT, digest)
+        logger.info(f"Sent image digest {digest.hex()}")
 
     def _request_insist(self, cmd: ProtocolCmd) -> Packet:
         self.send_request(cmd)
         response = self.receive_packet()
         while response.cmd == ProtocolCmd.RETX:
             logger.warning("Retransmitting")
+            self.stats.retx += 1
             self.send_request(cmd)
             response = self.receive_packet()
         return response
@@ -161,59 +634,179 @@ class BootloaderFlasher:
     def close(self):
         self.serial.close()
 
+    def _frame_header(self, packet: Packet) -> bytes:
+        return bytes([packet.cmd]) + packet.len.to_bytes(2, byteorder='big')
+
     def _checksum(self, packet: Packet) -> int:
+        if self.frame_version == FRAME_V2:
+            # zlib's CRC-32 is the one in bootloader/src/crc.c
+            return zlib.crc32(self._frame_header(packet) + bytes(packet.data[:packet.len]))
         checksum = 0
         checksum ^= self._crc8([packet.cmd])
         checksum ^= self._crc8([packet.len])
         checksum ^= self._crc8(packet.data[:packet.len])
         return checksum
 
-    def _crc8(self, data: list[int]) -> int:
+    @staticmethod
+    def _crc8(data: list[int]) -> int:
         crc = 0
         for byte in data:
-            crc ^= byte
-            for _ in range(8):
-                if crc & 0x80:
-                    crc = (crc << 1) ^ 0x07
-                else:
-                    crc <<= 1
+            crc = CRC8_TABLE[crc ^ byte]
         return crc
 
 if __name__ == "__main__":
     parser = ArgumentParser()
-    parser.add_argument("-f", "--file", help="Firmware file to flash", required=True)
+    parser.add_argument("-f", "--file", nargs="+", default=[],
+                        help="Firmware file to flash, one per slot, the target picks the slot")
     parser.add_argument("-p", "--port", help="Serial port", required=True)
     parser.add_argument("-b", "--baud", help="Baud rate", type=int, default=921600)
+    parser.add_argument("--max-baud", help="Fastest rate to switch to after sync, 0 to stay at --baud", type=int, default=BAUD_RATES[0])
+    parser.add_argument("-w", "--window", help="Packets in flight, 0 for stop-and-wait", type=int, default=DEFAULT_WINDOW)
+    parser.add_argument("--frame", help="Frame format to ask for", type=int, choices=[FRAME_V1, FRAME_V2], default=FRAME_V2)
+    parser.add_argument("-d", "--delta", help="Only send pages that differ from the flash", action="store_true")
+    parser.add_argument("-z", "--compress", help="Send an LZ compressed stream", action="store_true")
+    parser.add_argument("-s", "--sparse", help="Send pages of one byte value as fill commands", action="store_true")
+    parser.add_argument("--no-commit", help="Let the target hash the image after the transfer", action="store_true")
+    parser.add_argument("--trace", help="Read the target's cycle counts of its hot paths before the commit", action="store_true")
+    parser.add_argument("--bench", help="Write phase timings, RTTs and retransmits as JSON to this file, - for stdout")
+    parser.add_argument("--from-app", help="The target runs an app that hands over on request", action="store_true")
+    parser.add_argument("--wake", help="Seconds to keep a just reset target from starting its app", type=float)
+    parser.add_argument("--rollback", help="Only switch the target to the image in its other slot", action="store_true")
     parser.add_argument("-v", "--verbose", help="Verbose output", action="store_true")
     args = parser.parse_args()
+    if not args.file and not args.rollback:
+        parser.error("-f/--file is required unless --rollback")
     if args.verbose:
         basicConfig(level="DEBUG", format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
     else:
         basicConfig(level="INFO", format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    if args.compress and (args.delta or args.sparse):
+        parser.error("--compress cannot be combined with --delta or --sparse")
+    if args.trace and args.no_commit:
+        parser.error("--trace needs the commit, the target is done once the data is in")
     protocol = BootloaderFlasher(args.port, args.baud)
-    t0 = time.time()
-    protocol.send_sync()
+    if args.wake:
+        protocol.wake(args.wake)
+    stats = protocol.stats
+    t0 = time.perf_counter()
+    # Each slot needs an image linked for it, the target says which it wants
+    images = {}
+    for path in args.file:
+        with open(path, "rb") as f:
+            image = f.read()
+        images[image_load_addr(image)] = (path, image)
+    flags = 0 if args.no_commit else FW_FLAG_COMMIT
+    if args.delta:
+        # Delta transfers always end with a commit and need the windowed path
+        flags = FW_FLAG_DELTA | FW_FLAG_COMMIT
+        args.no_commit = False
+        args.window = max(args.window, 1)
+    # A compressed stream is addressed by its own offset, the target knows
+    # where it goes. Done up front, the target only waits so long for the length.
+    compressed = {}
+    if args.compress:
+        flags |= FW_FLAG_COMPRESSED
+        with stats.phase("compress"):
+            for load_addr, (path, image) in images.items():
+                compressed[load_addr] = compress(image)
+                logger.info("Compressed %s from %d bytes to %d (%.1f%%)", path, len(image),
+                            len(compressed[load_addr]), 100 * len(compressed[load_addr]) / max(len(image), 1))
+    with stats.phase("sync"):
+        if args.from_app:
+            protocol.request_from_app()
+        else:
+            protocol.send_sync()
+        protocol.negotiate_frame(args.frame)
+        if args.max_baud > args.baud:
+            protocol.pick_baud(args.max_baud)
     # version = protocol.request_version()
     # logger.info(f"Version: 0x{version:02X}")
-    protocol.request_update()
-    fw_len_bytes = os.path.getsize(args.file)
-    protocol.send_fw_length(fw_len_bytes)
-    ADDR_START = 0x0 + 0x8000
-    curr_addr = ADDR_START
-    bar = tqdm(total=fw_len_bytes, unit='B', unit_scale=True, ascii=True)
-    chunk_size = MAX_DATA_LEN - FW_ADDR_LEN
-    with open(args.file, "rb") as f:
-        data = f.read(chunk_size)
-        while data:
-            addr = curr_addr.to_bytes(FW_ADDR_LEN, byteorder='big')
-            protocol.send_fw_data(curr_addr, data)
-            bar.update(len(data))
-            curr_addr += len(data)
-            data = f.read(chunk_size)
+    if args.rollback:
+        slot, slot_addr = protocol.select_slot()
+        logger.info(f"Target starts slot {slot} at 0x{slot_addr:X} from now on")
+        protocol.close()
+        raise SystemExit(0)
+    with stats.phase("update_req"):
+        slot, ADDR_START = protocol.request_update()
+    if ADDR_START not in images:
+        raise BootloaderException(f"No image linked for slot {slot} at 0x{ADDR_START:X}, "
+                                  f"give it with -f, see tools/image-header.py --load-addr")
+    path, image = images[ADDR_START]
+    fw_len_bytes = len(image)
+    payload, base_addr = image, ADDR_START
+    if args.compress:
+        payload, base_addr = compressed[ADDR_START], 0
+    with stats.phase("length"):
+        window = protocol.send_fw_length(fw_len_bytes, args.window, flags)
+    chunks = None
+    if args.delta:
+        with stats.phase("delta_scan"):
+            chunks = protocol.delta_chunks(ADDR_START, image)
+    if args.sparse:
+        chunks = protocol.sparse_chunks(chunks if chunks is not None else [(ADDR_START, image)])
+    sent_bytes = len(payload) if chunks is None else sum(len(d) for _, d in chunks)
+    bar = tqdm(total=sent_bytes, unit='B', unit_scale=True, ascii=True)
+    chunk_size = protocol.max_data_len - FW_ADDR_LEN
+    with stats.phase("data"):
+        if chunks is not None and window:
+            protocol.send_chunks_windowed(chunks, window, bar.update)
+        elif chunks is not None:
+            for chunk_addr, data in chunks:
+                protocol.send_fw_data(chunk_addr, data)
+                bar.update(len(data))
+        elif window:
+            protocol.send_fw_windowed(base_addr, payload, window, bar.update)
+        else:
+            for off in range(0, len(payload), chunk_size):
+                data = payload[off:off + chunk_size]
+                protocol.send_fw_data(base_addr + off, data)
+                bar.update(len(data))
     bar.close()
-    done = protocol.receive_packet()
+    trace = None
+    if args.trace:
+        with stats.phase("trace"):
+            trace = protocol.read_trace()
+        for name, t in trace["events"].items():
+            logger.info("%-12s %6d x  mean %8.1f us  max %8.1f us  total %8.1f ms",
+                        name, t["count"], t["mean_us"], t["max_us"], t["total_ms"])
+    with stats.phase("done"):
+        if not args.no_commit:
+            protocol.send_commit(image)
+        done = protocol.receive_packet()
+    if done.cmd == ProtocolCmd.NACK:
+        log_target_stats(target_stats(done))
+        raise BootloaderException("Target rejected the image, was it built with tools/image-header.py?")
     if done.cmd != ProtocolCmd.FW_UPDATE_DONE:
         raise ValueError(f"Expected FW_UPDATE_DONE, got {done.cmd}")
-    update_time = time.time() - t0
-    logger.info("Firmware update done in %ds", update_time)
+    update_time = time.perf_counter() - t0
+    verify_us = None
+    if done.len >= 4:
+        verify_us = int.from_bytes(bytes(done.data[:4]), byteorder='big')
+        logger.info("Image SHA-256 verified on target in %.1f ms", verify_us / 1000)
+    counters = target_stats(done, 4)
+    log_target_stats(counters)
+    logger.info("Firmware update done in %.2fs (%.1f KB/s), slot %d starts from now on",
+                update_time, len(image) / 1024 / update_time, slot)
+    if args.bench:
+        data_time = stats.phases["data"]
+        report = {
+            "file": path, "slot": slot, "port": args.port,
+            "image_bytes": len(image), "sent_bytes": sent_bytes,
+            "baud": protocol.serial.baudrate, "frame": protocol.frame_version,
+            "max_data_len": protocol.max_data_len, "window": window, "flags": flags,
+            "total_s": update_time, "phases_s": stats.phases,
+            "bytes_per_s": len(image) / update_time,
+            "data_bytes_per_s": sent_bytes / data_time if data_time else None,
+            "rtt_ms": stats.rtt_summary(),
+            "retransmits": {"retx": stats.retx, "window_timeouts": stats.window_timeouts,
+                            "window_nacks": stats.window_nacks, "chunks_resent": stats.chunks_resent},
+            "verify_us": verify_us,
+            "trace": trace,
+            "target": counters,
+        }
+        if args.bench == "-":
+            print(json.dumps(report, indent=2))
+        else:
+            with open(args.bench, "w") as f:
+                json.dump(report, f, indent=2)
     protocol.close()
@@ -0,0 +1,128 @@
+"""Measures how long the host simulator takes from reset to starting a valid
+app, and checks the ways to keep it in the bootloader instead.
+
+    python3 tools/bench-boot.py -s build-sim/smartfusion_bootloader_sim \\
+        -i app/build/smartfusion_app_a-image.bin app/build/smartfusion_app_b-image.bin -n 20
+
+Runs, one JSON line each:
+- cold: valid app, no host, the reset to app latency
+- erased: no app, the bootloader has to stay
+- strap: valid app with the boot strap held (sim -s)
+- wake: valid app and flasher.py --wake, the update has to go through
+- app: the app hands over on flasher.py --from-app (sim -a), same
+
+The valid app is the slot A image, so the updates go to slot B and need its
+image too.
+
+The simulator does not model the system controller's SHA-256 time; on the
+board add the image check time the flasher reports."""
+import argparse
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+APP_START_ADDR = 0x8000
+
+parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("-s", "--sim", required=True, help="Simulator binary")
+parser.add_argument("-i", "--images", nargs="+", required=True, help="App images with their headers, one per slot")
+parser.add_argument("-n", "--runs", type=int, default=10, help="Cold boots to time")
+parser.add_argument("-o", "--output", help="Append results here instead of stdout")
+args = parser.parse_args()
+
+workdir = tempfile.mkdtemp(prefix="bench-boot-")
+port = os.path.join(workdir, "tty")
+flash = os.path.join(workdir, "flash.bin")
+out = open(args.output, "a") if args.output else sys.stdout
+
+def write_flash(image):
+    # A short file is erased eNVM from there on
+    with open(flash, "wb") as f:
+        if image is not None:
+            f.write(b"\xff" * APP_START_ADDR + image)
+
+def run_sim(options, until, timeout=10):
+    """Starts the sim and returns it with its output up to the first line
+    matching `until`."""
+    if os.path.lexists(port):
+        os.remove(port)
+    sim = subprocess.Popen([args.sim, "-p", port, "-f", flash] + options, stdout=subprocess.PIPE, text=True)
+    lines = []
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        line = sim.stdout.readline()
+        if not line:
+            break
+        lines.append(line.strip())
+        if re.search(until, line):
+            break
+    return sim, lines
+
+def stop(sim):
+    sim.kill()
+    sim.communicate()
+
+def report(result):
+    out.write(json.dumps(result) + "\n")
+    out.flush()
+    return result
+
+with open(args.images[0], "rb") as f:
+    image = f.read()
+
+boot_ms = []
+write_flash(image)
+for run in range(args.runs):
+    sim, lines = run_sim([], r"app started")
+    sim.wait()
+    m = re.search(r"app started ([\d.]+) ms after reset, image check (\d+) us", lines[-1] if lines else "")
+    result = report({"case": "cold", "run": run, "ok": m is not None,
+                     "boot_ms": float(m.group(1)) if m else None,
+                     "image_check_us": int(m.group(2)) if m else None})
+    if result["ok"]:
+        boot_ms.append(result["boot_ms"])
+
+write_flash(None)
+sim, lines = run_sim([], r"staying|app started")
+stop(sim)
+erased = report({"case": "erased", "ok": bool(lines) and "no valid app" in lines[-1]})
+
+write_flash(image)
+sim, lines = run_sim(["-s"], r"staying|app started")
+stop(sim)
+strap = report({"case": "strap", "ok": bool(lines) and "request: strap" in lines[-1]})
+
+def update(sim, options):
+    """Runs flasher.py against a started sim, True if it went through."""
+    flasher = [sys.executable, os.path.join(ROOT, "flasher.py"), "-f"] + args.images + ["-p", port] + options
+    ok = subprocess.run(flasher, stderr=subprocess.DEVNULL).returncode == 0
+    try:
+        sim_out, _ = sim.communicate(timeout=10)
+    except subprocess.TimeoutExpired:
+        sim.kill()
+        sim_out, _ = sim.communicate()
+    return ok, sim_out
+
+# The flasher has to be talking before the reset, the sim holds its reset
+# until then
+sim, _ = run_sim(["-d", "300"], r"bootloader on")
+ok, sim_out = update(sim, ["--wake", "0.5"])
+wake = report({"case": "wake", "ok": ok and "request: host" in sim_out})
+
+write_flash(image)
+sim, _ = run_sim(["-a", "921600"], r"app started")
+ok, sim_out = update(sim, ["--from-app"])
+app = report({"case": "app", "ok": ok and "request: app" in sim_out})
+
+if boot_ms:
+    print(f"cold boot to app: min {min(boot_ms):.3f} ms  median {statistics.median(boot_ms):.3f} ms  "
+          f"max {max(boot_ms):.3f} ms over {len(boot_ms)} runs", file=sys.stderr)
+for name, result in (("erased", erased), ("strap", strap), ("wake", wake), ("app", app)):
+    print(f"{name}: {'stayed in the bootloader' if result['ok'] else 'FAILED'}", file=sys.stderr)
+sys.exit(0 if len(boot_ms) == args.runs and erased["ok"] and strap["ok"] and wake["ok"] and app["ok"] else 1)
@@ -0,0 +1,76 @@
+"""Builds the host simulator once per buffer size combination and runs
+tools/bench-sim.py against each build, to see where sustained throughput
+stops growing with buffer size at a given baud rate.
+
+    python3 tools/bench-buffers.py -i app/build/smartfusion_app_a-image.bin \\
+        -b 3000000 --rx 256 1024 4096 --packets 2 4 8 16
+
+Each run is one JSON line, as from bench-sim.py plus the buffer sizes, and a
+table of the results goes to stderr at the end. The window asked for is one
+less than the packet slots unless a mode sets -w itself. The bootloader only
+grants it with --overlap, see BL_FLASH_OVERLAP in the README."""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+from itertools import product
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("-i", "--images", nargs="+", required=True)
+parser.add_argument("-b", "--bauds", nargs="+", type=int, default=[3000000])
+parser.add_argument("--rx", nargs="+", type=int, default=[1024], help="BL_UART_RX_BUFFER sizes")
+parser.add_argument("--packets", nargs="+", type=int, default=[8], help="BL_PACKET_BUFFERS sizes")
+parser.add_argument("--pages", nargs="+", type=int, default=[16], help="BL_FLASH_WRITER_PAGES sizes")
+parser.add_argument("-m", "--mode", action="append", dest="modes",
+                    help="flasher.py options of one run, e.g. --mode=-z, repeat for more")
+parser.add_argument("-t", "--program-us", type=int, help="Page program time given to the simulator")
+parser.add_argument("-o", "--output", help="Append results here instead of stdout")
+parser.add_argument("--overlap", action="store_true",
+                    help="Build with BL_FLASH_OVERLAP, without it the window is always one")
+parser.add_argument("--build-dir", help="Keep the simulator builds here")
+args = parser.parse_args()
+args.modes = args.modes or [""]
+
+build_root = args.build_dir or tempfile.mkdtemp(prefix="bench-buffers-")
+out = open(args.output, "a") if args.output else sys.stdout
+rows = []
+
+for rx, packets, pages in product(args.rx, args.packets, args.pages):
+    build = os.path.join(build_root, f"rx{rx}-pk{packets}-pg{pages}")
+    configure = ["cmake", "-S", os.path.join(ROOT, "bootloader", "sim"), "-B", build,
+                 f"-DBL_UART_RX_BUFFER={rx}", f"-DBL_PACKET_BUFFERS={packets}",
+                 f"-DBL_FLASH_WRITER_PAGES={pages}", f"-DBL_FLASH_OVERLAP={'ON' if args.overlap else 'OFF'}"]
+    if (subprocess.run(configure, stdout=subprocess.DEVNULL).returncode != 0 or
+            subprocess.run(["cmake", "--build", build], stdout=subprocess.DEVNULL).returncode != 0):
+        print(f"rx {rx} packets {packets} pages {pages}: build failed", file=sys.stderr)
+        continue
+    modes = [m if "-w" in m.split() else f"{m} -w {packets - 1}".strip() for m in args.modes]
+    bench = [sys.executable, os.path.join(ROOT, "tools", "bench-sim.py"),
+             "-s", os.path.join(build, "smartfusion_bootloader_sim"),
+             "-i"] + args.images + ["-b"] + [str(b) for b in args.bauds] + [f"--mode={m}" for m in modes]
+    if args.program_us is not None:
+        bench += ["-t", str(args.program_us)]
+    lines = subprocess.run(bench, stdout=subprocess.PIPE, text=True).stdout.splitlines()
+    for line in lines:
+        result = json.loads(line)
+        result["buffers"] = {"rx": rx, "packets": packets, "pages": pages}
+        out.write(json.dumps(result) + "\n")
+        out.flush()
+        report = result.get("flasher") or {}
+        target = report.get("target") or {}
+        rows.append((rx, packets, pages, result["baud"], result["mode"], result["ok"],
+                     (report.get("data_bytes_per_s") or 0) / 1024, report.get("total_s"),
+                     target.get("rx_dropped"), report.get("retransmits", {}).get("chunks_resent")))
+
+print(f"{'rx':>6} {'pkts':>4} {'pages':>5} {'baud':>8}  {'mode':<12} {'KB/s':>7} {'total s':>8} "
+      f"{'dropped':>7} {'resent':>6}", file=sys.stderr)
+for rx, packets, pages, baud, mode, ok, kbps, total, dropped, resent in rows:
+    if not ok:
+        print(f"{rx:>6} {packets:>4} {pages:>5} {baud:>8}  {mode:<12} failed", file=sys.stderr)
+        continue
+    print(f"{rx:>6} {packets:>4} {pages:>5} {baud:>8}  {mode:<12} {kbps:>7.1f} {total:>8.2f} "
+          f"{dropped if dropped is not None else '-':>7} {resent:>6}", file=sys.stderr)
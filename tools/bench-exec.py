@@ -0,0 +1,59 @@
+"""Collects the demo app's eNVM against eSRAM loop timing and its
+Reset_Handler to main() time off its UART. The app prints one line right after
+it starts, so reset the board a few times while this runs.
+
+    python3 tools/bench-exec.py -p /dev/ttyUSB0 -n 5
+
+Each report is one JSON line as the app sent it plus the times in
+microseconds, and a summary goes to stderr at the end. See
+app/src/loop-bench.c."""
+import argparse
+import json
+import statistics
+import sys
+import time
+
+from serial import Serial
+
+parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("-p", "--port", required=True, help="Serial port")
+parser.add_argument("-b", "--baud", type=int, default=921600, help="UART_BAUD of app/src/main.c")
+parser.add_argument("-n", "--runs", type=int, default=1, help="Reports to wait for")
+parser.add_argument("-t", "--timeout", type=float, default=60, help="Seconds to wait for all of them")
+parser.add_argument("-o", "--output", help="Append results here instead of stdout")
+args = parser.parse_args()
+
+out = open(args.output, "a") if args.output else sys.stdout
+serial = Serial(args.port, args.baud, timeout=0.5)
+results = []
+end = time.monotonic() + args.timeout
+while len(results) < args.runs and time.monotonic() < end:
+    line = serial.readline().decode(errors="replace").strip()
+    if not line.startswith('{"bench":"loop"'):
+        continue
+    try:
+        result = json.loads(line)
+    except ValueError:
+        continue  # Cut off by a reset
+    mhz = result["core_hz"] / 1e6
+    result["startup_us"] = result["startup_cycles"] / mhz
+    result["envm_us"] = result["envm_cycles"] / mhz
+    result["esram_us"] = result["esram_cycles"] / mhz if result["esram_cycles"] else None
+    out.write(json.dumps(result) + "\n")
+    out.flush()
+    results.append(result)
+serial.close()
+
+if not results:
+    sys.exit("No report from the app, is it running and at this baud rate?")
+startup = [r["startup_cycles"] for r in results]
+envm = [r["envm_cycles"] for r in results]
+esram = [r["esram_cycles"] for r in results if r["esram_cycles"]]
+print(f"Startup: median {statistics.median(startup)} cycles, Reset_Handler to main()", file=sys.stderr)
+print(f"eNVM:  median {statistics.median(envm)} cycles over {len(envm)} runs", file=sys.stderr)
+if not esram:
+    print("eSRAM: .ram_code was not loaded, is the bootloader older than the app?", file=sys.stderr)
+    sys.exit(1)
+print(f"eSRAM: median {statistics.median(esram)} cycles, "
+      f"{statistics.median(envm) / statistics.median(esram):.2f}x faster", file=sys.stderr)
+sys.exit(0 if all(r["match"] for r in results) else 1)
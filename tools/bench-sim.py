@@ -0,0 +1,65 @@
+"""Runs flasher.py --bench against the host simulator for every combination
+of image, baud rate and flasher options, one JSON object per line.
+
+    python3 tools/bench-sim.py -s build-sim/smartfusion_bootloader_sim \\
+        -i app/build/smartfusion_app_a-image.bin -b 921600 3000000 --mode= --mode=-z
+
+Each run starts from an erased eNVM, so delta runs only make sense with
+--keep-flash. An erased target takes the slot A image. With --keep-flash every
+update goes to the other slot, give both images of an app joined by a comma,
+e.g. -i smartfusion_app_a-image.bin,smartfusion_app_b-image.bin."""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("-s", "--sim", required=True, help="Simulator binary")
+parser.add_argument("-i", "--images", nargs="+", required=True)
+parser.add_argument("-b", "--bauds", nargs="+", type=int, default=[921600])
+parser.add_argument("-m", "--mode", action="append", dest="modes",
+                    help="flasher.py options of one run, e.g. --mode=-z, repeat for more")
+parser.add_argument("-t", "--program-us", type=int, help="Page program time given to the simulator")
+parser.add_argument("-o", "--output", help="Append results here instead of stdout")
+parser.add_argument("--keep-flash", action="store_true", help="Reuse the eNVM of the previous run")
+args = parser.parse_args()
+args.modes = args.modes or [""]
+
+workdir = tempfile.mkdtemp(prefix="bench-sim-")
+port = os.path.join(workdir, "tty")
+flash = os.path.join(workdir, "flash.bin")
+out = open(args.output, "a") if args.output else sys.stdout
+
+for image in args.images:
+    for baud in args.bauds:
+        for mode in args.modes:
+            if not args.keep_flash and os.path.exists(flash):
+                os.remove(flash)
+            # Hold the strap, a kept eNVM has a valid app the sim would start
+            sim_cmd = [args.sim, "-p", port, "-f", flash, "-s"]
+            if args.program_us is not None:
+                sim_cmd += ["-t", str(args.program_us)]
+            sim = subprocess.Popen(sim_cmd, stdout=subprocess.PIPE, text=True)
+            while not os.path.exists(port):
+                time.sleep(0.01)
+            report = os.path.join(workdir, "report.json")
+            flasher = [sys.executable, os.path.join(ROOT, "flasher.py"), "-f"] + image.split(",") + ["-p", port,
+                       "--max-baud", str(baud), "--bench", report] + mode.split()
+            ok = subprocess.run(flasher, stderr=subprocess.DEVNULL).returncode == 0
+            try:
+                sim_out, _ = sim.communicate(timeout=10)
+            except subprocess.TimeoutExpired:
+                sim.kill()
+                sim_out, _ = sim.communicate()
+            result = {"image": image, "baud": baud, "mode": mode, "ok": ok,
+                      "sim": sim_out.strip().splitlines()[-1] if sim_out.strip() else None}
+            if ok:
+                with open(report) as f:
+                    result["flasher"] = json.load(f)
+            out.write(json.dumps(result) + "\n")
+            out.flush()
@@ -0,0 +1,62 @@
+"""Ratio of the compressed transfer for app binaries and, with --sim, the
+measured transfer time raw and compressed.
+
+    python3 tools/compress-bench.py app/build/smartfusion_app_a-image.bin [...]
+    python3 tools/compress-bench.py app/build/smartfusion_app_a-image.bin \\
+        -s build-sim/smartfusion_bootloader_sim -b 921600 3000000
+
+The times come from flasher.py --bench runs through tools/bench-sim.py, one
+without and one with -z per image and baud rate, each from an erased eNVM.
+They include the host's compression and the target's expansion."""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+from lz import compress, decompress
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+
+parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("files", nargs="+")
+parser.add_argument("-s", "--sim", help="Simulator binary to measure transfers against")
+parser.add_argument("-b", "--bauds", nargs="+", type=int, default=[921600])
+args = parser.parse_args()
+
+
+def measure(name: str, baud: int, mode: str):
+    """Total seconds of one flasher run against the simulator, None if it failed."""
+    cmd = [sys.executable, os.path.join(TOOLS, "bench-sim.py"), "-s", args.sim, "-i", name,
+           "-b", str(baud), f"--mode={mode}"]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, text=True).stdout.strip()
+    result = json.loads(out.splitlines()[-1]) if out else {}
+    return result["flasher"]["total_s"] if result.get("ok") else None
+
+
+print(f"{'file':40} {'raw':>8} {'lz':>8} {'ratio':>6} {'enc s':>6}")
+for name in args.files:
+    with open(name, "rb") as f:
+        image = f.read()
+    t0 = time.perf_counter()
+    packed = compress(image)
+    encode = time.perf_counter() - t0
+    if decompress(packed, len(image)) != image:
+        raise SystemExit(f"{name}: round trip failed")
+    ratio = len(image) / max(len(packed), 1)
+    print(f"{name[-40:]:40} {len(image):8} {len(packed):8} {ratio:6.2f} {encode:6.2f}")
+
+if args.sim:
+    print()
+    print(f"{'file':40} {'baud':>8} {'raw s':>7} {'lz s':>7} {'raw KB/s':>9} {'lz KB/s':>8} {'speedup':>7}")
+    for name in args.files:
+        size_kb = os.path.getsize(name) / 1024
+        for baud in args.bauds:
+            raw_s = measure(name, baud, "")
+            lz_s = measure(name, baud, "-z")
+            if raw_s is None or lz_s is None:
+                print(f"{name[-40:]:40} {baud:8} transfer failed")
+                continue
+            print(f"{name[-40:]:40} {baud:8} {raw_s:7.3f} {lz_s:7.3f} {size_kb / raw_s:9.1f} "
+                  f"{size_kb / lz_s:8.1f} {raw_s / lz_s:7.2f}")
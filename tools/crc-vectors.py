@@ -0,0 +1,36 @@
+"""Checks flasher.py's CRC-8 and the zlib CRC-32 it frames v2 packets with
+against the vectors the bootloader's crc.c is tested with.
+
+    python3 tools/crc-vectors.py
+
+Also run by ctest in the bootloader/sim build."""
+import os
+import sys
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, ROOT)
+from flasher import BootloaderFlasher
+
+VECTORS = os.path.join(ROOT, "bootloader", "sim", "test", "crc-vectors.txt")
+
+cases = failures = 0
+with open(VECTORS) as f:
+    for line_no, line in enumerate(f, 1):
+        if not line.strip() or line.startswith("#"):
+            continue
+        hex_data, crc8, crc32 = line.split()
+        data = b"" if hex_data == "-" else bytes.fromhex(hex_data)
+        cases += 1
+        got8 = BootloaderFlasher._crc8(data)
+        if got8 != int(crc8, 16):
+            print(f"line {line_no}: _crc8 {got8:02x}, expected {crc8}", file=sys.stderr)
+            failures += 1
+        got32 = zlib.crc32(data)
+        if got32 != int(crc32, 16):
+            print(f"line {line_no}: zlib.crc32 {got32:08x}, expected {crc32}", file=sys.stderr)
+            failures += 1
+if cases == 0:
+    sys.exit(f"No test vectors in {VECTORS}")
+print(f"{cases} CRC vectors, {failures} failed")
+sys.exit(1 if failures else 0)
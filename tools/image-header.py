@@ -0,0 +1,91 @@
+import argparse
+import hashlib
+import struct
+
+# Must match ImageHeader in bootloader/inc/image.h
+IMAGE_HEADER_SIZE = 0x200
+IMAGE_MAGIC = 0x49424653  # "SFBI"
+IMAGE_HEADER_VERSION = 2
+APP_SLOT_ADDRS = (0x8000, 0x23C00)  # APP_SLOT_ADDR() in bootloader/inc/bootloader.h
+NVM_ABS_ADDRESS = 0x60000000  # Load addresses in the app's ELF, see app/linkerscript.ld
+IMAGE_FLAG_RAM_CODE = 0x01
+IMAGE_MAX_SECTIONS = 4
+APP_RAM_CODE = (0x20000040, 0x20004000)  # APP_RAM_CODE_ADDR and its end
+
+def elf_sections(path):
+    """Name -> (run address, load address, size) of each section of a 32-bit
+    little endian ELF file. The load address comes from the segment holding
+    the section."""
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:6] != b"\x7fELF\x01\x01":
+        raise SystemExit(f"{path}: not a 32-bit little endian ELF file")
+    phoff, shoff = struct.unpack_from("<II", elf, 0x1C)
+    phentsize, phnum, shentsize, shnum, shstrndx = struct.unpack_from("<HHHHH", elf, 0x2A)
+    # type, offset, vaddr, paddr, filesz
+    segments = [struct.unpack_from("<IIIII", elf, phoff + i * phentsize) for i in range(phnum)]
+    # name, type, flags, addr, offset, size
+    headers = [struct.unpack_from("<IIIIII", elf, shoff + i * shentsize) for i in range(shnum)]
+    names = headers[shstrndx][4]
+    sections = {}
+    for name, _, _, addr, _, size in headers:
+        name = elf[names + name:elf.index(b"\0", names + name)].decode()
+        load = addr
+        for p_type, _, vaddr, paddr, filesz in segments:
+            if p_type == 1 and vaddr <= addr < vaddr + filesz:  # PT_LOAD
+                load = paddr + addr - vaddr
+        sections[name] = (addr, load, size)
+    return sections
+
+parser = argparse.ArgumentParser(description="Prepend the bootloader image header to an app binary")
+parser.add_argument("-f", "--file", required=True, help="App binary linked after the header")
+parser.add_argument("-o", "--output", default="image.bin")
+parser.add_argument("--flags", type=lambda x: int(x, 0), default=0)
+parser.add_argument("--version", type=lambda x: int(x, 0), default=0, help="Image version, the higher one boots")
+parser.add_argument("--load-addr", type=lambda x: int(x, 0), default=APP_SLOT_ADDRS[0],
+                    help="Slot address the binary was linked for")
+parser.add_argument("--elf", help="The ELF file the binary came from, for --ram-section")
+parser.add_argument("--ram-section", action="append", default=[],
+                    help="Section the bootloader copies to the eSRAM before the jump, repeat for more")
+args = parser.parse_args()
+if args.load_addr not in APP_SLOT_ADDRS:
+    parser.error(f"--load-addr must be one of {', '.join(hex(a) for a in APP_SLOT_ADDRS)}")
+if args.ram_section and not args.elf:
+    parser.error("--ram-section needs --elf")
+
+with open(args.file, "rb") as f:
+    image = f.read()
+
+# Copied by the bootloader from the image to where the app runs them
+ram_sections = []
+if args.ram_section:
+    sections = elf_sections(args.elf)
+    image_start = NVM_ABS_ADDRESS + args.load_addr + IMAGE_HEADER_SIZE
+    for name in args.ram_section:
+        if name not in sections:
+            raise SystemExit(f"{args.elf}: no section {name}")
+        run, load, size = sections[name]
+        if size == 0:
+            continue
+        offset = load - image_start
+        if (offset | run | size) & 3 or offset < 0 or offset + size > len(image):
+            raise SystemExit(f"{name}: not a word aligned part of the image")
+        if run < APP_RAM_CODE[0] or run + size > APP_RAM_CODE[1]:
+            raise SystemExit(f"{name}: 0x{run:X}+{size} is outside the app's eSRAM code region")
+        ram_sections.append((offset, run, size))
+    if len(ram_sections) > IMAGE_MAX_SECTIONS:
+        raise SystemExit(f"At most {IMAGE_MAX_SECTIONS} eSRAM sections")
+flags = args.flags | (IMAGE_FLAG_RAM_CODE if ram_sections else 0)
+
+header = struct.pack("<IIII32sIII", IMAGE_MAGIC, IMAGE_HEADER_VERSION, len(image),
+                     flags, hashlib.sha256(image).digest(), args.version, args.load_addr,
+                     len(ram_sections))
+for section in ram_sections:
+    header += struct.pack("<III", *section)
+header += bytes([0xff] * (IMAGE_HEADER_SIZE - len(header)))
+
+with open(args.output, "wb") as f:
+    f.write(header + image)
+print(f"{args.output}: {len(image)} byte image for 0x{args.load_addr:X}, version {args.version}, sha256 {hashlib.sha256(image).hexdigest()}")
+for offset, run, size in ram_sections:
+    print(f"  {size} bytes at image offset 0x{offset:X} run from 0x{run:X}")
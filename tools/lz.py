@@ -0,0 +1,102 @@
+"""LZ4-style compressor for firmware images, decoded on target by
+bootloader/src/lz.c. See bootloader/inc/lz.h for the stream format."""
+
+WINDOW_SIZE = 1024  # Must match LZ_WINDOW_SIZE in bootloader/inc/lz.h
+MIN_MATCH = 4
+MAX_CHAIN = 32      # Candidates tried per position, trades ratio for speed
+
+
+def _put_len(out: bytearray, value: int):
+    while value >= 255:
+        out.append(255)
+        value -= 255
+    out.append(value)
+
+
+def _put_sequence(out: bytearray, literals: bytes, offset: int, match_len: int):
+    lit_nibble = min(len(literals), 15)
+    match_nibble = min(match_len - MIN_MATCH, 15) if offset else 0
+    out.append((lit_nibble << 4) | match_nibble)
+    if lit_nibble == 15:
+        _put_len(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += offset.to_bytes(2, byteorder='little')
+        if match_nibble == 15:
+            _put_len(out, match_len - MIN_MATCH - 15)
+
+
+def compress(data: bytes, window: int = WINDOW_SIZE) -> bytes:
+    out = bytearray()
+    chains = {}
+    n = len(data)
+    i = 0
+    literal_start = 0
+    while i < n:
+        best_len = 0
+        best_offset = 0
+        if i + MIN_MATCH <= n:
+            key = data[i:i + MIN_MATCH]
+            chain = chains.setdefault(key, [])
+            for pos in reversed(chain[-MAX_CHAIN:]):
+                offset = i - pos
+                if offset > window:
+                    break
+                length = MIN_MATCH
+                while i + length < n and data[pos + length] == data[i + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_offset = length, offset
+            chain.append(i)
+            if len(chain) > 4 * MAX_CHAIN:
+                del chain[:-MAX_CHAIN]
+        if best_len < MIN_MATCH:
+            i += 1
+            continue
+        _put_sequence(out, data[literal_start:i], best_offset, best_len)
+        for j in range(i + 1, min(i + best_len, n - MIN_MATCH + 1)):
+            chain = chains.setdefault(data[j:j + MIN_MATCH], [])
+            chain.append(j)
+            if len(chain) > 4 * MAX_CHAIN:
+                del chain[:-MAX_CHAIN]
+        i += best_len
+        literal_start = i
+    if literal_start < n:
+        _put_sequence(out, data[literal_start:], 0, 0)
+    return bytes(out)
+
+
+def decompress(data: bytes, out_len: int) -> bytes:
+    """Reference decoder, same rules as lz_decode()."""
+    out = bytearray()
+    i = 0
+
+    def get_len(value):
+        nonlocal i
+        if value == 15:
+            while True:
+                more = data[i]
+                i += 1
+                value += more
+                if more != 255:
+                    break
+        return value
+
+    while len(out) < out_len:
+        token = data[i]
+        i += 1
+        literal_len = get_len(token >> 4)
+        out += data[i:i + literal_len]
+        i += literal_len
+        if len(out) >= out_len:
+            break
+        offset = int.from_bytes(data[i:i + 2], byteorder='little')
+        i += 2
+        if offset == 0 or offset > WINDOW_SIZE or offset > len(out):
+            raise ValueError(f"Bad offset {offset} at {i}")
+        match_len = get_len(token & 0x0F) + MIN_MATCH
+        for _ in range(match_len):
+            out.append(out[-offset])
+    if len(out) != out_len:
+        raise ValueError("Stream decodes to the wrong length")
+    return bytes(out)